@@ -7,6 +7,17 @@
  * 2016-2017 Jon Tamir <jtamir@eecs.berkeley.edu>
  */
 
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <omp.h>
+
+#include <boost/make_shared.hpp>
+
 // includes for orchestra
 
 #include <MDArray/Utils.h>
@@ -45,6 +56,8 @@
 
 // includes for bart
 #include <assert.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "misc/mri.h"
 #include "misc/misc.h"
@@ -56,6 +69,16 @@
 #include "num/fft.h"
 
 #include "BartIO.h"
+#include "BlockPipeline.h"
+#include "CoilCompression.h"
+#include "DicomWriter.h"
+#include "FusedFFT.h"
+#include "ImageKernels.h"
+#include "NoiseWhitening.h"
+#include "PfileRawData.h"
+#include "ReconEngine.h"
+#include "ScanArchiveIndex.h"
+#include "TransposeKernels.h"
 
 
 // Include this to avoid having to type fully qualified names
@@ -110,15 +133,60 @@ void BartIO::FormatBartMRIDims(long odims[DIMS], const long idims[PFILE_DIMS])
  */
 void BartIO::FormatBartMRI(long odims[DIMS], _Complex float* odata, const long idims[PFILE_DIMS], const _Complex float* idata)
 {
-	md_set_dims(DIMS, odims, 1);
-	md_transpose_dims(PFILE_DIMS, 3, 4, odims, idims);
+	const long plane = idims[0] * idims[1] * idims[2];
 
-	md_transpose(PFILE_DIMS, 3, 4, odims, odata, idims, idata, CFL_SIZE); 
+	if (odata == idata)
+		BartIO::TransposePlanesInPlace(plane, idims[3], idims[4], idims[5], odata);
+	else
+		BartIO::TransposePlanes(plane, idims[3], idims[4], idims[5], odata, idata);
 
 	BartIO::FormatBartMRIDims(odims, idims);
 }
 
 
+/**
+ * Strides of an array in bart mri convention, listed in Pfile dimension order, i.e.
+ *
+ * Array dims:  [Read, Phs1, Phs2, Coil, 1, TE, 1, 1, 1, 1, Phase]
+ * Output strides for: [Read, Phs1, Phs2, TE, Coil, Phase]
+ */
+void BartIO::FormatBartMRIStrides(long ostrs[PFILE_DIMS], const long odims[DIMS])
+{
+	long strs[DIMS];
+	md_calc_strides(DIMS, strs, odims, CFL_SIZE);
+
+	ostrs[0] = strs[READ_DIM];
+	ostrs[1] = strs[PHS1_DIM];
+	ostrs[2] = strs[PHS2_DIM];
+	ostrs[3] = strs[TE_DIM];
+	ostrs[4] = strs[COIL_DIM];
+	ostrs[5] = strs[TIME_DIM];
+}
+
+
+/**
+ * Map flags over Pfile dimensions to flags over bart mri dimensions, i.e.
+ *
+ * Input flags:  [Read, Phs1, Phs2, TE, Coil, Phase]
+ * Output flags: [Read, Phs1, Phs2, Coil, 1, TE, 1, 1, 1, 1, Phase]
+ */
+unsigned long BartIO::FormatBartMRIFlags(unsigned long flags)
+{
+	unsigned long oflags = flags & (READ_FLAG | PHS1_FLAG | PHS2_FLAG);
+
+	if (MD_IS_SET(flags, 3))
+		oflags |= TE_FLAG;
+
+	if (MD_IS_SET(flags, 4))
+		oflags |= COIL_FLAG;
+
+	if (MD_IS_SET(flags, 5))
+		oflags |= TIME_FLAG;
+
+	return oflags;
+}
+
+
 /**
  * Tranpose arrays to match Orchestra mri convention, i.e.
  *
@@ -132,7 +200,21 @@ void BartIO::FormatOxMRI(long odims[PFILE_DIMS], _Complex float* odata, const lo
 	md_set_dims(DIMS, tdims, 1);
 	md_transpose_dims(DIMS, 3, 5, tdims, idims);
 
-	md_transpose(DIMS, 3, 5, tdims, odata, idims, idata, CFL_SIZE); 
+	if (1 == idims[4]) {
+
+		const long plane = idims[0] * idims[1] * idims[2];
+		const long count = md_calc_size(DIMS - 6, idims + 6);
+
+		if (odata == idata)
+			BartIO::TransposePlanesInPlace(plane, idims[3], idims[5], count, odata);
+		else
+			BartIO::TransposePlanes(plane, idims[3], idims[5], count, odata, idata);
+
+	} else {
+
+		assert(odata != idata);
+		md_transpose(DIMS, 3, 5, tdims, odata, idims, idata, CFL_SIZE);
+	}
 
 	// data are in correct order. Just make odims to match output dims
 	md_copy_dims(PFILE_DIMS, odims, tdims);
@@ -150,228 +232,1317 @@ bool BartIO::get_zip_dir(const long dims[PFILE_DIMS], const Legacy::PfilePointer
 	const long d[1] = { dims[0] * dims[1] };
 	const int numSlices = dims[2];
 
-	const ComplexFloatMatrix k0 = pfile->KSpaceData<float>(numSlices / 2, 0, 0, 0);
-	const ComplexFloatMatrix k1 = pfile->KSpaceData<float>(numSlices * 3 / 2, 0, 0, 0);
+	const ComplexFloatMatrix k0 = pfile->KSpaceData<float>(numSlices / 2, 0, 0, 0);
+	const ComplexFloatMatrix k1 = pfile->KSpaceData<float>(numSlices * 3 / 2, 0, 0, 0);
+
+	float v0 = md_zscalar_real(1, d,(const _Complex float*)k0.data(), (const _Complex float*)k0.data());
+	float v1 = md_zscalar_real(1, d, (const _Complex float*)k1.data(), (const _Complex float*)k1.data());
+
+	if (0. == v0 && 0. < v1)
+		return false;
+	else if (0. < v0 && 0. == v1)
+		return true;
+	else {
+
+		debug_printf(DP_WARN, "Could not auto-detect zip padding. Trying to grab first half...\n");
+		return true;
+	}
+}
+
+
+/*
+ * Load the archive storage which contains all acquisition data held in the archive
+ */
+static Acquisition::ArchiveStoragePointer ScanArchiveStorage(const ScanArchivePointer& scanArchive)
+{
+	// Set the GERecon::Path locations prior to loading the saved files
+	const boost::filesystem::path scanArchiveFullPath = scanArchive->Path();
+	Path::SetAllInputPaths(scanArchiveFullPath.parent_path() / "ScanArchiveFiles");
+	scanArchive->LoadSavedFiles();
+
+	return Acquisition::ArchiveStorage::Create(scanArchive);
+}
+
+
+/*
+ * Index entry of a control packet
+ */
+static BartIO::ScanArchiveIndex::Entry ScanArchiveIndexEntry(const Acquisition::FrameControlPointer& controlPacketAndFrameData, const size_t controlPacketIndex)
+{
+	BartIO::ScanArchiveIndex::Entry entry;
+
+	entry.control = controlPacketIndex;
+	entry.opcode = controlPacketAndFrameData->Control().Opcode();
+	entry.view = -1;
+	entry.slice = -1;
+	entry.echo = -1;
+
+	if (controlPacketAndFrameData->Control().Opcode() == Acquisition::ProgrammableOpcode) {
+
+		const Acquisition::ProgrammableControlPacket framePacket = controlPacketAndFrameData->Control().Packet().As<Acquisition::ProgrammableControlPacket>();
+
+		entry.view = Acquisition::GetPacketValue(framePacket.viewNumH, framePacket.viewNumL);
+		entry.slice = Acquisition::GetPacketValue(framePacket.sliceNumH, framePacket.sliceNumL);
+		entry.echo = framePacket.echoNum;
+	}
+
+	return entry;
+}
+
+
+/*
+ * True for the scan control packet that ends the scan. Other scan control
+ * packets, e.g. the end of a pass, are followed by more data.
+ */
+static bool IsEndOfScan(const Acquisition::FrameControlPointer& controlPacketAndFrameData)
+{
+	if (controlPacketAndFrameData->Control().Opcode() != Acquisition::ScanControlOpcode)
+		return false;
+
+	const Acquisition::ScanControlPacket scanPacket = controlPacketAndFrameData->Control().Packet().As<Acquisition::ScanControlPacket>();
+
+	return Acquisition::EndOfScanCommand == scanPacket.command;
+}
+
+
+/*
+ * Selection of the stored frames. In sequential mode the selected slices
+ * and echoes are stored along the views
+ */
+static BartIO::Selection ScanArchiveStoredSelection(const bool store_sequential, const BartIO::Selection& selection)
+{
+	BartIO::Selection stored = selection;
+
+	if (store_sequential) {
+
+		stored.start[2] = stored.start[3] = 0;
+		stored.end[2] = stored.end[3] = -1;
+	}
+
+	return stored;
+}
+
+
+/*
+ * Index all control packets of the archive storage
+ */
+static void ScanArchiveFillIndex(BartIO::ScanArchiveIndex& index, const Acquisition::ArchiveStoragePointer& archiveStorage)
+{
+	const size_t numControls = archiveStorage->AvailableControlCount();
+
+	for (size_t controlPacketIndex = 0; controlPacketIndex < numControls; ++controlPacketIndex)
+		index.Add(ScanArchiveIndexEntry(archiveStorage->NextFrameControl(), controlPacketIndex));
+}
+
+
+/**
+ * Walk all control packets of a ScanArchive and write the index next to it
+ */
+void BartIO::ScanArchiveBuildIndex(const ScanArchivePointer scanArchive)
+{
+	Trace trace("ScanArchiveBuildIndex");
+
+	BartIO::ScanArchiveIndex index;
+	ScanArchiveFillIndex(index, ScanArchiveStorage(scanArchive));
+
+	if (!index.Save(scanArchive->Path()))
+		error("Could not write index for %s!\n", scanArchive->Path().string().c_str());
+
+	std::cout << "Indexed " << index.ControlCount() << " control packets in " << BartIO::ScanArchiveIndex::IndexPath(scanArchive->Path()).string() << std::endl;
+}
+
+
+long BartIO::ScanArchiveFrameCount(const ScanArchivePointer scanArchive, const Selection& selection)
+{
+	Trace trace("ScanArchiveFrameCount");
+
+	BartIO::ScanArchiveIndex index;
+
+	if (!index.Load(scanArchive->Path()))
+		return -1;
+
+	// the index must cover the whole archive
+	if (index.ControlCount() != ScanArchiveStorage(scanArchive)->AvailableControlCount())
+		return -1;
+
+	long numFrames = 0;
+
+	for (size_t controlPacketIndex = 0; controlPacketIndex < index.ControlCount(); ++controlPacketIndex) {
+
+		const BartIO::ScanArchiveIndex::Entry& entry = index[controlPacketIndex];
+
+		if ((entry.view > 0) && selection.Contains(2, entry.slice) && selection.Contains(3, entry.echo))
+			numFrames++;
+	}
+
+	return numFrames;
+}
+
+
+/*
+ * Frames per chunk of ScanArchiveReadFrames
+ */
+static const long FrameChunkViews = 1024;
+
+
+long BartIO::ScanArchiveReadFrames(FrameChunks& chunks, const long dims[PFILE_DIMS], const ScanArchivePointer scanArchive, const Selection& selection, const _Complex float* whitening)
+{
+	Trace trace("ScanArchiveReadFrames");
+
+	const Range all = Range::all();
+
+	Acquisition::ArchiveStoragePointer archiveStorage = ScanArchiveStorage(scanArchive);
+
+	const size_t numControls = archiveStorage->AvailableControlCount();
+
+	long sdims[PFILE_DIMS];
+	selection.Dims(sdims, dims);
+
+	const long frameSize = dims[0] * sdims[4];
+
+	BartIO::ScanArchiveIndex index;
+
+	chunks.clear();
+	long numFrames = 0;
+
+	for (size_t controlPacketIndex = 0; controlPacketIndex < numControls; ++controlPacketIndex) {
+
+		const Acquisition::FrameControlPointer controlPacketAndFrameData = archiveStorage->NextFrameControl();
+
+		const BartIO::ScanArchiveIndex::Entry entry = ScanArchiveIndexEntry(controlPacketAndFrameData, controlPacketIndex);
+		index.Add(entry);
+
+		// image frames of the selection
+		if ((Acquisition::ProgrammableOpcode != entry.opcode) || (entry.view <= 0))
+			continue;
+
+		if (!selection.Contains(2, entry.slice) || !selection.Contains(3, entry.echo))
+			continue;
+
+		if (0 == numFrames % FrameChunkViews)
+			chunks.push_back(std::vector<_Complex float>(FrameChunkViews * frameSize));
+
+		const ComplexFloatCube frameRawData = controlPacketAndFrameData->Data();
+		const ComplexFloatMatrix oneReadout = frameRawData(all, all, 0);
+
+		const _Complex float* src = (const _Complex float*)oneReadout.data() + selection.start[4] * dims[0];
+		_Complex float* dst = chunks.back().data() + (numFrames % FrameChunkViews) * frameSize;
+
+		if (NULL != whitening)
+			BartIO::WhitenChannels(dims[0], sdims[4], dims[0], dst, dims[0], src, whitening);
+		else
+			memcpy(dst, src, frameSize * CFL_SIZE);
+
+		numFrames++;
+	}
+
+	if (!index.Save(scanArchive->Path()))
+		debug_printf(DP_WARN, "Could not write index for %s.\n", scanArchive->Path().string().c_str());
+
+	return numFrames;
+}
+
+
+/*
+ * Compress a [Read, Coil] readout of n samples into the virtual coils at dst.
+ * Geometric compression works along Read in image space, so the readout is
+ * transformed first (readIFFT) and the output is left in hybrid space.
+ * scratch holds n * (channels + virtual coils) samples.
+ */
+static void CompressReadout(const BartIO::CoilCompression& coils, const BartIO::FusedFFT* readIFFT, const long n, const long ostrs[PFILE_DIMS], _Complex float* dst, const _Complex float* src, _Complex float* scratch)
+{
+	unsigned int N = PFILE_DIMS;
+
+	const long numChannels = coils.ChannelCount();
+
+	_Complex float* vtmp = scratch + n * numChannels;
+
+	if (NULL != readIFFT) {
+
+		memcpy(scratch, src, n * numChannels * CFL_SIZE);
+		readIFFT->Apply(scratch);
+		src = scratch;
+	}
+
+	long vdims[N];
+	md_singleton_dims(N, vdims);
+	vdims[0] = n;
+	vdims[4] = coils.VirtualCount();
+
+	long vstrs[N];
+	md_singleton_strides(N, vstrs);
+	vstrs[0] = CFL_SIZE;
+	vstrs[4] = n * CFL_SIZE;
+
+	const long dims2[2] = { n, 1 };
+	const long strs2[2] = { (long)CFL_SIZE, n * (long)CFL_SIZE };
+
+	md_clear(N, vdims, vtmp, CFL_SIZE);
+
+	for (long c = 0; c < numChannels; c++)
+		coils.Accumulate(c, dims2, strs2, vstrs[4], vtmp, strs2, src + c * n);
+
+	md_copy2(N, vdims, ostrs, dst, vstrs, vtmp, CFL_SIZE);
+}
+
+
+void BartIO::CopyFrames(const long dims[PFILE_DIMS], const long ostrs[PFILE_DIMS], _Complex float* out, const FrameChunks& chunks, const CoilCompression* coils)
+{
+	unsigned int N = PFILE_DIMS;
+
+	long dims1[N];
+	md_select_dims(N, READ_FLAG | COIL_FLAG, dims1, dims);
+
+	long strs1[N];
+	md_singleton_strides(N, strs1);
+	strs1[0] = CFL_SIZE;
+	strs1[4] = dims[0] * CFL_SIZE;
+
+	const long frameSize = dims[0] * dims[4];
+
+	boost::shared_ptr<BartIO::FusedFFT> readIFFT;
+
+	if ((NULL != coils) && coils->Hybrid())
+		readIFFT.reset(new BartIO::FusedFFT(N, dims1, 0, MD_BIT(0), 0));
+
+	// a readout of the channels and one of the virtual coils
+	long tdims[N];
+	md_copy_dims(N, tdims, dims1);
+
+	if (NULL != coils)
+		tdims[4] += coils->VirtualCount();
+
+#pragma omp parallel
+	{
+		_Complex float* scratch = (NULL != coils) ? (_Complex float*)md_alloc(N, tdims, CFL_SIZE) : NULL;
+
+#pragma omp for
+		for (long frame = 0; frame < dims[1]; frame++) {
+
+			const _Complex float* src = chunks[frame / FrameChunkViews].data() + (frame % FrameChunkViews) * frameSize;
+			_Complex float* dst = (_Complex float*)((char*)out + frame * ostrs[1]);
+
+			if (NULL != coils)
+				CompressReadout(*coils, readIFFT.get(), dims[0], ostrs, dst, src, scratch);
+			else
+				md_copy2(N, dims1, ostrs, dst, strs1, src, CFL_SIZE);
+		}
+
+		if (NULL != scratch)
+			md_free(scratch);
+	}
+}
+
+
+void BartIO::FramesCalibration(const long caldims[PFILE_DIMS], _Complex float* cal, const long dims[PFILE_DIMS], const FrameChunks& chunks)
+{
+	assert((1 == caldims[2]) && (1 == caldims[3]) && (1 == caldims[5]) && (caldims[4] == dims[4]));
+
+	const long frameSize = dims[0] * dims[4];
+
+	// centered region, as CoilCompression::Calibration
+	const long firstSample = dims[0] / 2 - caldims[0] / 2;
+	const long firstFrame = dims[1] / 2 - caldims[1] / 2;
+
+	for (long f = 0; f < caldims[1]; f++) {
+
+		const long frame = firstFrame + f;
+		const _Complex float* src = chunks[frame / FrameChunkViews].data() + (frame % FrameChunkViews) * frameSize;
+
+		for (long c = 0; c < caldims[4]; c++)
+			memcpy(cal + (c * caldims[1] + f) * caldims[0], src + c * dims[0] + firstSample, caldims[0] * CFL_SIZE);
+	}
+}
+
+
+long BartIO::ScanArchiveToBart(const long dims[PFILE_DIMS], _Complex float* out, const ScanArchivePointer scanArchive, const bool store_sequential, const Selection& selection, const _Complex float* whitening)
+{
+	long sdims[PFILE_DIMS];
+	ScanArchiveStoredSelection(store_sequential, selection).Dims(sdims, dims);
+
+	long ostrs[PFILE_DIMS];
+	md_calc_strides(PFILE_DIMS, ostrs, sdims, CFL_SIZE);
+
+	return BartIO::ScanArchiveToBart2(dims, ostrs, out, scanArchive, store_sequential, selection, whitening);
+}
+
+
+/*
+ * Copy the block [bpos, bpos + bdims) of the stored selection to out. Frames
+ * outside of the block are counted but not decoded.
+ */
+static long ScanArchiveCopy(const long dims[PFILE_DIMS], const long bpos[PFILE_DIMS], const long bdims[PFILE_DIMS], const long ostrs[PFILE_DIMS], _Complex float* out,
+		const ScanArchivePointer scanArchive, const bool store_sequential, const BartIO::Selection& selection, const _Complex float* whitening, const BartIO::CoilCompression* coils)
+{
+	Trace trace("ScanArchiveToBart");
+
+	unsigned int N = PFILE_DIMS;
+
+	// FIXME: check compatibility of pfile dimensions
+	// FIXME: check phases vs passes
+
+#if 0
+	const int numPhases = dims[5];
+#else
+	//const int numPasses = dims[5];
+#endif
+
+	const Range all = Range::all();
+
+	Acquisition::ArchiveStoragePointer archiveStorage = ScanArchiveStorage(scanArchive);
+
+	// Determine how many control (DAB) packets are contained in the storage
+	const size_t numControls = archiveStorage->AvailableControlCount();
+	std::cout << "numControls is " << numControls << std::endl;
+
+	// With an index of the archive the packets need not be decoded, and
+	// reading stops after the last selected frame. Without, the index is
+	// built on the way.
+	BartIO::ScanArchiveIndex index;
+	const bool indexed = index.Load(scanArchive->Path()) && (index.ControlCount() == numControls);
+
+	if (!indexed)
+		index = BartIO::ScanArchiveIndex();
+
+	size_t lastControl = numControls;
+
+	if (indexed) {
+
+		debug_printf(DP_DEBUG1, "Using index %s\n", BartIO::ScanArchiveIndex::IndexPath(scanArchive->Path()).string().c_str());
+
+		lastControl = 0;
+
+		for (size_t controlPacketIndex = 0; controlPacketIndex < numControls; ++controlPacketIndex) {
+
+			const BartIO::ScanArchiveIndex::Entry& entry = index[controlPacketIndex];
+
+			if ((entry.view > 0) && selection.Contains(2, entry.slice) && selection.Contains(3, entry.echo))
+				lastControl = controlPacketIndex + 1;
+		}
+	}
+
+	int frameType = 0;
+	int viewIndex = 0;
+	int viewValue = 0;
+	int echoIndex = 0;
+	int sliceIndex = 0;
+
+	long pos[N];
+	md_set_dims(N, pos, 0);
+
+	// frames outside of the selection are skipped
+	long sdims[N];
+	ScanArchiveStoredSelection(store_sequential, selection).Dims(sdims, dims);
+
+	long dims1[N];
+	md_singleton_dims(N, dims1);
+
+	//BartIO::BartDims(dims1, oneReadout);
+	dims1[0] = bdims[0]; // readout
+	dims1[4] = sdims[4]; // coils
+
+	long strs1[N];
+	md_singleton_strides(N, strs1);
+	strs1[0] = CFL_SIZE;
+	strs1[4] = dims[0] * CFL_SIZE;
+
+	// channels of a readout are mixed by a GEMM, which needs contiguous readouts
+	assert((NULL == whitening) || (CFL_SIZE == ostrs[0]));
+
+	// compression replaces whitening, and needs full readouts
+	assert((NULL == coils) || ((NULL == whitening) && (bdims[0] == dims[0]) && (coils->ChannelCount() == sdims[4])));
+
+	boost::shared_ptr<BartIO::FusedFFT> readIFFT;
+
+	if ((NULL != coils) && coils->Hybrid())
+		readIFFT.reset(new BartIO::FusedFFT(N, dims1, 0, MD_BIT(0), 0));
+
+	// a readout of the channels and one of the virtual coils, per thread
+	long tdims[N];
+	md_copy_dims(N, tdims, dims1);
+
+	if (NULL != coils)
+		tdims[4] += coils->VirtualCount();
+
+	std::vector<_Complex float*> scratch((NULL != coils) ? omp_get_max_threads() : 0, (_Complex float*)NULL);
+
+	// Frames are decoded in batches. A sequential pass over the control packets
+	// resolves the destinations; a frame replaces an earlier frame of the batch
+	// with the same destination, so the last acquired frame wins. The payloads of
+	// the unique destinations are then fetched and copied in parallel.
+	const size_t batchSize = 64 * omp_get_max_threads();
+
+	std::vector<Acquisition::FrameControlPointer> batchFrames;
+	std::vector<long> batchOffsets;
+	std::map<long, size_t> batchSlots;
+
+	batchFrames.reserve(batchSize);
+	batchOffsets.reserve(batchSize);
+
+	auto copyBatch = [&]() {
+
+#pragma omp parallel for schedule(dynamic, 4)
+		for (long i = 0; i < (long)batchFrames.size(); i++) {
+
+			const ComplexFloatCube frameRawData = batchFrames[i]->Data();
+			const ComplexFloatMatrix oneReadout = frameRawData(all, all, 0); // is this "zero" the index for pass?
+
+			// selected channels of the readout, from the start of the block
+			const _Complex float* src = (const _Complex float*)oneReadout.data() + selection.start[4] * dims[0] + bpos[0];
+			_Complex float* dst = (_Complex float*)((char*)out + batchOffsets[i]);
+
+			if (NULL != coils) {
+
+				_Complex float*& tmp = scratch[omp_get_thread_num()];
+
+				if (NULL == tmp)
+					tmp = (_Complex float*)md_alloc(N, tdims, CFL_SIZE);
+
+				CompressReadout(*coils, readIFFT.get(), dims[0], ostrs, dst, src, tmp);
+			}
+			else if (NULL != whitening)
+				BartIO::WhitenChannels(dims1[0], dims1[4], ostrs[4] / CFL_SIZE, dst, dims[0], src, whitening);
+			else
+				md_copy2(N, dims1, ostrs, dst, strs1, src, CFL_SIZE);
+		}
+
+		batchFrames.clear();
+		batchOffsets.clear();
+		batchSlots.clear();
+	};
+
+	// Loop over all control packets in the archive. Some control packtes are scan control packets
+	//which may indicate the end of an acquisition (pass) or the end of the scan. Other control
+	// packets are frame control packets which describe the raw frame (or view) data they're
+	// associated with. All control packets and associated frame data are stored in the archive
+	// in the order they're acquired.
+	unsigned int num_views = 0;
+	size_t controlPacketIndex = 0;
+
+	for (; controlPacketIndex < lastControl; ++controlPacketIndex)
+	{
+		const Acquisition::FrameControlPointer controlPacketAndFrameData = archiveStorage->NextFrameControl();
+
+		if (!indexed)
+			index.Add(ScanArchiveIndexEntry(controlPacketAndFrameData, controlPacketIndex));
+
+		const BartIO::ScanArchiveIndex::Entry& entry = index[controlPacketIndex];
+
+		if (entry.opcode == Acquisition::ProgrammableOpcode)
+		{
+
+			// Only include ImageFrames
+			viewValue = entry.view;
+			frameType = viewValue == 0 ? Acquisition::BaselineFrame : Acquisition::ImageFrame;
+
+			if (frameType == Acquisition::ImageFrame) {
+
+				// If packet view number == 0, then this is a baseline view, else correct the baseline view number
+				viewIndex = viewValue == 0 ? 0 : viewValue - 1;
+				echoIndex = entry.echo;
+				sliceIndex = entry.slice;
+
+				if (!selection.Contains(2, sliceIndex) || !selection.Contains(3, echoIndex))
+					continue;
+
+				if (store_sequential) {
+
+					// frames in order of acquisition
+					if ((long)num_views >= sdims[1] * sdims[5]) {
+
+						debug_printf(DP_WARN, "More frames than views in sequential mode. Skipping the rest.\n");
+						break;
+					}
+
+					pos[1] = num_views % sdims[1];
+					pos[5] = num_views / sdims[1];
+				}
+				else {
+
+					pos[1] = viewIndex;
+					pos[2] = sliceIndex - selection.start[2];
+					pos[3] = echoIndex - selection.start[3];
+					//pos[5] = currentPass; // FIXME: check for multiple passes
+				}
+
+				num_views++;
+
+				bool inBlock = true;
+
+				for (unsigned int i = 1; i < N; i++)
+					inBlock = inBlock && (pos[i] >= bpos[i]) && (pos[i] < bpos[i] + bdims[i]);
+
+				if (!inBlock)
+					continue;
+
+				// position within the block. Readouts are cut when copied
+				long opos[N];
+
+				for (unsigned int i = 0; i < N; i++)
+					opos[i] = (0 == i) ? 0 : pos[i] - bpos[i];
+
+				const long offset = md_calc_offset(N, ostrs, opos);
+				const std::map<long, size_t>::iterator slot = batchSlots.find(offset);
+
+				if (batchSlots.end() != slot) {
+
+					batchFrames[slot->second] = controlPacketAndFrameData;
+
+				} else {
+
+					batchSlots[offset] = batchFrames.size();
+					batchFrames.push_back(controlPacketAndFrameData);
+					batchOffsets.push_back(offset);
+				}
+
+				if (batchFrames.size() == batchSize)
+					copyBatch();
+			}
+		}
+	}
+
+	copyBatch();
+
+	for (size_t i = 0; i < scratch.size(); i++)
+		if (NULL != scratch[i])
+			md_free(scratch[i]);
+
+	// a partial index would give later runs a short frame count
+	if (!indexed && (numControls == controlPacketIndex))
+		index.Save(scanArchive->Path());
+
+	return num_views;
+}
+
+long BartIO::ScanArchiveToBart2(const long dims[PFILE_DIMS], const long ostrs[PFILE_DIMS], _Complex float* out, const ScanArchivePointer scanArchive, const bool store_sequential, const Selection& selection, const _Complex float* whitening, const CoilCompression* coils)
+{
+	long sdims[PFILE_DIMS];
+	ScanArchiveStoredSelection(store_sequential, selection).Dims(sdims, dims);
+
+	long bpos[PFILE_DIMS];
+	md_set_dims(PFILE_DIMS, bpos, 0);
+
+	return ScanArchiveCopy(dims, bpos, sdims, ostrs, out, scanArchive, store_sequential, selection, whitening, coils);
+}
+
+
+void BartIO::ScanArchiveCalibration(const long caldims[PFILE_DIMS], _Complex float* cal, const long dims[PFILE_DIMS], const ScanArchivePointer scanArchive, const bool store_sequential, const Selection& selection)
+{
+	long sdims[PFILE_DIMS];
+	ScanArchiveStoredSelection(store_sequential, selection).Dims(sdims, dims);
+
+	// centered region, as CoilCompression::Calibration
+	long pos[PFILE_DIMS];
+	md_set_dims(PFILE_DIMS, pos, 0);
+
+	for (int i = 0; i < 3; i++)
+		pos[i] = sdims[i] / 2 - caldims[i] / 2;
+
+	long calstrs[PFILE_DIMS];
+	md_calc_strides(PFILE_DIMS, calstrs, caldims, CFL_SIZE);
+
+	md_clear(PFILE_DIMS, caldims, cal, CFL_SIZE);
+
+	ScanArchiveCopy(dims, pos, caldims, calstrs, cal, scanArchive, store_sequential, selection, NULL, NULL);
+}
+
+
+long BartIO::ScanArchiveFollow(const long dims[PFILE_DIMS], const ScanArchivePointer scanArchive, const Selection& selection, const long blockViews, const double timeout,
+		const std::function<void(long block, const long bdims[PFILE_DIMS], const long bstrs[PFILE_DIMS], const _Complex float* data)>& emit, const _Complex float* whitening)
+{
+	Trace trace("ScanArchiveFollow");
+
+	unsigned int N = PFILE_DIMS;
+
+	assert(blockViews > 0);
+
+	const Range all = Range::all();
+
+	Acquisition::ArchiveStoragePointer archiveStorage = ScanArchiveStorage(scanArchive);
+
+	long sdims[N];
+	selection.Dims(sdims, dims);
+
+	long bdims[N];
+	md_singleton_dims(N, bdims);
+	bdims[0] = dims[0];
+	bdims[1] = blockViews;
+	bdims[4] = sdims[4];
+
+	long bstrs[N];
+	md_calc_strides(N, bstrs, bdims, CFL_SIZE);
+
+	long dims1[N];
+	md_select_dims(N, READ_FLAG | COIL_FLAG, dims1, bdims);
+
+	long strs1[N];
+	md_singleton_strides(N, strs1);
+	strs1[0] = CFL_SIZE;
+	strs1[4] = dims[0] * CFL_SIZE;
+
+	_Complex float* block = (_Complex float*)md_alloc(N, bdims, CFL_SIZE);
+
+	long numBlocks = 0;
+	long numFrames = 0;
+
+	auto flush = [&](const long views) {
+
+		long edims[N];
+		md_copy_dims(N, edims, bdims);
+		edims[1] = views;
+
+		emit(numBlocks++, edims, bstrs, block);
+	};
+
+	size_t controlPacketIndex = 0;
+	std::chrono::steady_clock::time_point lastPacket = std::chrono::steady_clock::now();
+
+	bool endOfScan = false;
+
+	while (!endOfScan) {
+
+		// packets appended by the acquisition since the last poll
+		const size_t numControls = archiveStorage->AvailableControlCount();
+
+		if (controlPacketIndex == numControls) {
+
+			const std::chrono::duration<double> idle = std::chrono::steady_clock::now() - lastPacket;
+
+			// fallback for archives that end without a scan control packet
+			if (idle.count() > timeout) {
+
+				debug_printf(DP_WARN, "No end of scan after %g s idle, stopping.\n", timeout);
+				break;
+			}
+
+			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+			continue;
+		}
+
+		for (; !endOfScan && (controlPacketIndex < numControls); ++controlPacketIndex) {
+
+			const Acquisition::FrameControlPointer controlPacketAndFrameData = archiveStorage->NextFrameControl();
+			const BartIO::ScanArchiveIndex::Entry entry = ScanArchiveIndexEntry(controlPacketAndFrameData, controlPacketIndex);
+
+			// the acquisition ends with a scan control packet. Passes end with one, too
+			if (IsEndOfScan(controlPacketAndFrameData)) {
+
+				endOfScan = true;
+				continue;
+			}
+
+			// Only include ImageFrames of the selection
+			if ((entry.view <= 0) || !selection.Contains(2, entry.slice) || !selection.Contains(3, entry.echo))
+				continue;
+
+			const ComplexFloatCube frameRawData = controlPacketAndFrameData->Data();
+			const ComplexFloatMatrix oneReadout = frameRawData(all, all, 0);
+
+			const _Complex float* src = (const _Complex float*)oneReadout.data() + selection.start[4] * dims[0];
+			_Complex float* dst = block + (numFrames % blockViews) * dims[0];
+
+			if (NULL != whitening)
+				BartIO::WhitenChannels(dims[0], dims1[4], bstrs[4] / CFL_SIZE, dst, dims[0], src, whitening);
+			else
+				md_copy2(N, dims1, bstrs, dst, strs1, src, CFL_SIZE);
+
+			if (0 == ++numFrames % blockViews)
+				flush(blockViews);
+		}
+
+		lastPacket = std::chrono::steady_clock::now();
+	}
+
+	if (0 != numFrames % blockViews)
+		flush(numFrames % blockViews);
+
+	md_free(block);
+
+	debug_printf(DP_DEBUG1, "Followed %ld frames in %ld blocks.\n", numFrames, numBlocks);
+
+	return numFrames;
+}
+
+
+/**
+ * Extract Pfile data and copy to BART array
+ * Assumes nothing about conventions of dimensions.
+ * Limited to 6 dimensions because that's what the Pfile contains...
+ */
+void BartIO::PfileToBart(const long dims[PFILE_DIMS], _Complex float* out, const Legacy::PfilePointer& pfile, const float pfileVersion)
+{
+	long strs[PFILE_DIMS];
+	md_calc_strides(PFILE_DIMS, strs, dims, CFL_SIZE);
+
+	BartIO::PfileToBart2(dims, strs, out, pfile, pfileVersion);
+}
+
+
+BartIO::IngestOptions::IngestOptions()
+	: numReaders(2), fftmod_flags(0), ifft_flags(0), fft_flags(0), whitening(NULL)
+{
+}
+
+
+BartIO::Selection::Selection()
+{
+	md_set_dims(PFILE_DIMS, start, 0);
+	md_set_dims(PFILE_DIMS, end, -1);
+}
+
+
+void BartIO::Selection::Select(const int dim, const std::string& range)
+{
+	assert((0 <= dim) && (dim < PFILE_DIMS));
+
+	const size_t colon = range.find(':');
+
+	const std::string first = range.substr(0, colon);
+	const std::string last = (std::string::npos == colon) ? std::string() : range.substr(colon + 1);
+
+	char* tail = NULL;
+
+	start[dim] = first.empty() ? 0 : strtol(first.c_str(), &tail, 10);
+
+	if (!first.empty() && ('\0' != *tail))
+		error("Invalid range %s!\n", range.c_str());
+
+	if (std::string::npos == colon) {
+
+		end[dim] = start[dim] + 1;
+		return;
+	}
+
+	end[dim] = last.empty() ? -1 : strtol(last.c_str(), &tail, 10);
+
+	if (!last.empty() && ('\0' != *tail))
+		error("Invalid range %s!\n", range.c_str());
+}
+
+
+void BartIO::Selection::Dims(long sdims[PFILE_DIMS], const long dims[PFILE_DIMS]) const
+{
+	for (int i = 0; i < PFILE_DIMS; i++) {
+
+		const long e = (-1 == end[i]) ? dims[i] : end[i];
+
+		if ((start[i] < 0) || (e > dims[i]) || (start[i] >= e))
+			error("Selection %ld:%ld out of range for dimension %d of size %ld!\n", start[i], e, i, dims[i]);
+
+		sdims[i] = e - start[i];
+	}
+}
+
+
+bool BartIO::Selection::Contains(const int dim, const long index) const
+{
+	return (index >= start[dim]) && ((-1 == end[dim]) || (index < end[dim]));
+}
+
+
+/**
+ * Extract Pfile data and scatter each readout directly into its
+ * position in an array following the bart mri convention
+ */
+void BartIO::PfileToBartMRI(const long odims[DIMS], _Complex float* out, const long dims[PFILE_DIMS], const Legacy::PfilePointer& pfile, const float pfileVersion, const IngestOptions& options)
+{
+	long ostrs[PFILE_DIMS];
+	BartIO::FormatBartMRIStrides(ostrs, odims);
+
+	BartIO::PfileToBart2(dims, ostrs, out, pfile, pfileVersion, options);
+}
+
+
+/*
+ * Map the raw data region of the Pfile. Returns an empty pointer if the raw
+ * layout is not supported or does not match the k-space returned by the Pfile.
+ */
+static boost::shared_ptr<BartIO::PfileRawData> PfileRawDataOpen(const long dims[PFILE_DIMS], const Legacy::PfilePointer& pfile, const float pfileVersion, const boost::filesystem::path& pfilePath, const bool zip_forward)
+{
+	const int numSlices = dims[2];
+	const int numEchoes = dims[3];
+	const int numChannels = dims[4];
+	const int numPasses = dims[5];
+
+	const int numZipSlices = pfile->SliceCount();
+
+	boost::shared_ptr<BartIO::PfileRawData> rawData = boost::make_shared<BartIO::PfileRawData>(pfilePath, pfile, pfileVersion);
+
+	if (!rawData->IsValid())
+		return boost::shared_ptr<BartIO::PfileRawData>();
+
+	if ((rawData->ReadoutSize() != dims[0]) || (rawData->ViewCount() != dims[1]) || (pfile->PassCount() < numPasses))
+		return boost::shared_ptr<BartIO::PfileRawData>();
+
+	// Check the first and last block against the reference reader, and
+	// blocks one step along a single index, which catch swapped strides
+	const int firstSlice = zip_forward ? 0 : numZipSlices - 1;
+	const int nextSlice = firstSlice + (zip_forward ? 1 : -1) * std::min(1, numSlices - 1);
+	const int lastSlice = zip_forward ? numSlices - 1 : numZipSlices - numSlices;
+
+	const int nextEcho = std::min(1, numEchoes - 1);
+	const int nextChannel = std::min(1, numChannels - 1);
+
+	// [Pass, Slice, Echo, Channel]
+	const int blocks[][4] = {
+
+		{ 0, firstSlice, 0, 0 },
+		{ 0, firstSlice, 0, nextChannel },
+		{ 0, nextSlice, 0, 0 },
+		{ 0, firstSlice, nextEcho, 0 },
+		{ numPasses - 1, lastSlice, numEchoes - 1, numChannels - 1 },
+	};
+
+	for (unsigned int i = 0; i < sizeof(blocks) / sizeof(blocks[0]); i++)
+		if (!rawData->Verify(pfile, blocks[i][0], blocks[i][1], blocks[i][2], blocks[i][3]))
+			return boost::shared_ptr<BartIO::PfileRawData>();
+
+	return rawData;
+}
+
+
+/*
+ * Position of a block of views. Blocks are numbered in the order of the raw data:
+ * [Echo, Slice, Channel, Pass]
+ */
+static void PfileBlockPos(long pos[PFILE_DIMS], const long dims[PFILE_DIMS], long index)
+{
+	md_set_dims(PFILE_DIMS, pos, 0);
+
+	pos[3] = index % dims[3];
+	index /= dims[3];
+
+	pos[2] = index % dims[2];
+	index /= dims[2];
+
+	pos[4] = index % dims[4];
+	index /= dims[4];
+
+	pos[5] = index;
+}
+
+
+/*
+ * If ZIP is enabled, we have to figure out what side of the pfile was zero-padded.
+ * Returns false if the slices are stored in reverse order.
+ */
+static bool PfileZipForward(const long dims[PFILE_DIMS], const Legacy::PfilePointer& pfile, const float pfileVersion)
+{
+	if (pfileVersion >= 26.)
+		return true;
+
+	const bool zip_on = dims[2] < pfile->SliceCount();
+
+	return zip_on ? BartIO::get_zip_dir(dims, pfile) : true;
+}
+
+
+/*
+ * Read all views of a (pass, slice, echo, channel) into a contiguous block
+ */
+static void PfileReadBlock(const long dims1[PFILE_DIMS], _Complex float* out, const Legacy::PfilePointer& pfile, const boost::shared_ptr<BartIO::PfileRawData>& rawData, const int pass, const int slice, const int echo, const int channel)
+{
+	unsigned int N = PFILE_DIMS;
+
+	if (rawData) {
+
+		long strs1[N];
+		md_calc_strides(N, strs1, dims1, CFL_SIZE);
+
+		rawData->Read(out, strs1, pass, slice, echo, channel);
+		return;
+	}
+
+	ComplexFloatMatrix kSpace;
+
+	if (pfile->IsZEncoded()) {
+
+		const ComplexFloatMatrix kSpace1 = pfile->KSpaceData<float>(Legacy::Pfile::PassSlicePair(pass, slice), echo, channel);
+		kSpace.reference(kSpace1);
+	}
+	else {
+
+		const ComplexFloatMatrix kSpace1 = pfile->KSpaceData<float>(slice, echo, channel, pass);
+		kSpace.reference(kSpace1);
+	}
+
+	long dims2[N];
+	BartIO::BartDims(dims2, kSpace);
+	assert(md_check_compat(N, 0u, dims1, dims2));
+
+	md_copy(N, dims1, out, kSpace.data(), CFL_SIZE);
+}
+
+
+/**
+ * Extract the calibration region of the Pfile data for coil compression.
+ * Only the blocks overlapping the region are read.
+ */
+void BartIO::PfileToBartCalibration(const long caldims[PFILE_DIMS], _Complex float* cal, const long dims[PFILE_DIMS], const Legacy::PfilePointer& pfile, const float pfileVersion, const IngestOptions& options)
+{
+	unsigned int N = PFILE_DIMS;
+
+	const bool zip_forward = PfileZipForward(dims, pfile, pfileVersion);
+	const int numZipSlices = pfile->SliceCount();
+
+	boost::shared_ptr<BartIO::PfileRawData> rawData;
+
+	if (!options.pfilePath.empty())
+		rawData = PfileRawDataOpen(dims, pfile, pfileVersion, options.pfilePath, zip_forward);
+
+	const BartIO::Selection& sel = options.selection;
+
+	long sdims[N];
+	sel.Dims(sdims, dims);
+
+	long dims1[N];
+	md_select_dims(N, MD_BIT(0) | MD_BIT(1), dims1, dims);
+
+	long caldims1[N];
+	md_select_dims(N, MD_BIT(0) | MD_BIT(1), caldims1, caldims);
+
+	long calstrs[N];
+	md_calc_strides(N, calstrs, caldims, CFL_SIZE);
+
+	// centered region within each block
+	long pos[N];
+	md_set_dims(N, pos, 0);
+	pos[0] = dims[0] / 2 - caldims[0] / 2;
+	pos[1] = dims[1] / 2 - caldims[1] / 2;
+
+	const long firstSlice = sel.start[2] + sdims[2] / 2 - caldims[2] / 2;
+	const long numBlocks = caldims[2] * caldims[4];
+
+#pragma omp parallel num_threads(std::max(1, options.numReaders))
+	{
+		_Complex float* tmp = (_Complex float*)md_alloc(N, dims1, CFL_SIZE);
+
+#pragma omp for
+		for (long index = 0; index < numBlocks; index++) {
+
+			const int slice = firstSlice + index % caldims[2];
+			const int channel = index / caldims[2];
+
+			const int sl = zip_forward ? slice : numZipSlices - slice - 1;
+
+			PfileReadBlock(dims1, tmp, pfile, rawData, sel.start[5], sl, sel.start[3], sel.start[4] + channel);
+
+			long cpos[N];
+			md_set_dims(N, cpos, 0);
+			cpos[2] = index % caldims[2];
+			cpos[4] = channel;
+
+			_Complex float* dst = (_Complex float*)((char*)cal + md_calc_offset(N, calstrs, cpos));
+
+			md_copy_block(N, pos, caldims1, dst, dims1, tmp, CFL_SIZE);
+		}
+
+		md_free(tmp);
+	}
+}
+
+
+/**
+ * Extract Pfile data and copy to a strided BART array
+ * Limited to 6 dimensions because that's what the Pfile contains...
+ *
+ * Blocks of views are read by a few I/O threads into a ring of buffers and
+ * converted and placed by the remaining threads.
+ */
+void BartIO::PfileToBart2(const long dims[PFILE_DIMS], const long ostrs[PFILE_DIMS], _Complex float* out, const Legacy::PfilePointer& pfile, const float pfileVersion, const IngestOptions& options)
+{
+	Trace trace("PfileToBart");
+
+	unsigned int N = PFILE_DIMS;
+
+	// FIXME: check compatibility of pfile dimensions
+	// FIXME: check phases vs passes
+
+	// only the selected blocks are read
+	const BartIO::Selection& sel = options.selection;
+
+	long sdims[N];
+	sel.Dims(sdims, dims);
+
+	assert((sdims[0] == dims[0]) && (sdims[1] == dims[1]));
+
+	const int numSlices = sdims[2];
+	const int numEchoes = sdims[3];
+	const int numChannels = sdims[4];
+#if 0
+	const int numPhases = sdims[5];
+#else
+	const int numPasses = sdims[5];
+#endif
+
+	const bool zip_forward = PfileZipForward(dims, pfile, pfileVersion);
+	const int numZipSlices = pfile->SliceCount();
+
+	boost::shared_ptr<BartIO::PfileRawData> rawData;
+
+	if (!options.pfilePath.empty()) {
+
+		rawData = PfileRawDataOpen(dims, pfile, pfileVersion, options.pfilePath, zip_forward);
+
+		if (rawData)
+			debug_printf(DP_DEBUG1, "Reading memory-mapped raw data\n");
+		else
+			debug_printf(DP_WARN, "Raw data layout not supported. Reading k-space per channel...\n");
+	}
+
+	// one block holds all views of a (pass, slice, echo, channel)
+	long dims1[N];
+	md_select_dims(N, MD_BIT(0) | MD_BIT(1), dims1, dims);
+
+	long strs1[N];
+	md_calc_strides(N, strs1, dims1, CFL_SIZE);
+
+	const long numBlocks = (long)numPasses * numChannels * numSlices * numEchoes;
+	const size_t blockBytes = std::max(md_calc_size(N, dims1) * CFL_SIZE, rawData ? (size_t)rawData->BlockBytes() : 0);
+
+	BartIO::BlockPipeline pipeline(blockBytes, options.numReaders);
+
+	// output dims. Channels are accumulated into virtual coils when compressing
+	const boost::shared_ptr<const BartIO::CoilCompression>& coils = options.coils;
+
+	long odims[N];
+	md_copy_dims(N, odims, sdims);
 
-	float v0 = md_zscalar_real(1, d,(const _Complex float*)k0.data(), (const _Complex float*)k0.data());
-	float v1 = md_zscalar_real(1, d, (const _Complex float*)k1.data(), (const _Complex float*)k1.data());
+	if (coils) {
 
-	if (0. == v0 && 0. < v1)
-		return false;
-	else if (0. < v0 && 0. == v1)
-		return true;
-	else {
+		assert(coils->ChannelCount() == numChannels);
 
-		debug_printf(DP_WARN, "Could not auto-detect zip padding. Trying to grab first half...\n");
-		return true;
+		odims[4] = coils->VirtualCount();
+		md_clear2(N, odims, ostrs, out, CFL_SIZE);
 	}
-}
 
+	const _Complex float* whitening = coils ? NULL : options.whitening;
 
-long BartIO::ScanArchiveToBart(const long dims[PFILE_DIMS], _Complex float* out, const ScanArchivePointer scanArchive, const bool store_sequential)
-{
-	Trace trace("ScanArchiveToBart");
+	// channels of a readout are mixed by a GEMM, which needs contiguous readouts
+	assert((NULL == whitening) || (CFL_SIZE == ostrs[0]));
 
-	unsigned int N = PFILE_DIMS;
+	// one lock per (pass, slice, echo) for accumulating or counting channels
+	const long numGroups = (long)numPasses * numSlices * numEchoes;
+	std::vector<std::mutex> locks((coils || whitening) ? numGroups : 0);
 
-	// FIXME: check compatibility of pfile dimensions
-	// FIXME: check phases vs passes
+	// channels placed per (pass, slice, echo), for whitening once all are there
+	std::vector<long> placed(whitening ? numGroups : 0, 0);
 
-#if 0
-	const int numPhases = dims[5];
-#else
-	//const int numPasses = dims[5];
-#endif
+	// transforms within a block are done while it is hot, before placing it
+	const unsigned long fftFlags = options.fftmod_flags | options.ifft_flags | options.fft_flags;
+	const bool blockFFT = !coils && (0 != fftFlags) && (0 == (fftFlags & ~(MD_BIT(0) | MD_BIT(1))));
 
-	const Range all = Range::all();
+	boost::shared_ptr<BartIO::FusedFFT> fused;
 
-	// Set the GERecon::Path locations prior to loading the saved files
-	const boost::filesystem::path scanArchiveFullPath = scanArchive->Path();
-	Path::SetAllInputPaths(scanArchiveFullPath.parent_path() / "ScanArchiveFiles");
-	scanArchive->LoadSavedFiles();
-	// Load the archive storage which contains all acquisition data held in the archive
-	Acquisition::ArchiveStoragePointer archiveStorage = Acquisition::ArchiveStorage::Create(scanArchive);
+	if (blockFFT)
+		fused.reset(new BartIO::FusedFFT(N, dims1, options.fftmod_flags, options.ifft_flags, options.fft_flags));
 
-	// Determine how many control (DAB) packets are contained in the storage
-	const size_t numControls = archiveStorage->AvailableControlCount();
-	std::cout << "numControls is " << numControls << std::endl;
+	if (coils && coils->Hybrid())
+		fused.reset(new BartIO::FusedFFT(N, dims1, 0, MD_BIT(0), 0));
 
-	int frameType = 0;
-	int viewIndex = 0;
-	int viewValue = 0;
-	int echoIndex = 0;
-	int sliceIndex = 0;
+	// per-thread scratch block for converting raw views before processing
+	std::vector<_Complex float*> scratch(omp_get_max_threads(), (_Complex float*)NULL);
 
-	long pos[N];
-	md_set_dims(N, pos, 0);
+	// per-thread [Read, Coil] readout for whitening
+	std::vector<_Complex float*> readouts(whitening ? omp_get_max_threads() : 0, (_Complex float*)NULL);
 
-	long dims1[N];
-	md_singleton_dims(N, dims1);
+	// whiten the readouts of a (pass, slice, echo) after its last channel is placed
+	auto whitenPlaced = [&](long pos[PFILE_DIMS]) {
 
-	//BartIO::BartDims(dims1, oneReadout);
-	dims1[0] = dims[0]; // readout
-	dims1[4] = dims[4]; // coils
+		if (NULL == whitening)
+			return;
 
-	// Loop over all control packets in the archive. Some control packtes are scan control packets
-	//which may indicate the end of an acquisition (pass) or the end of the scan. Other control
-	// packets are frame control packets which describe the raw frame (or view) data they're
-	// associated with. All control packets and associated frame data are stored in the archive
-	// in the order they're acquired.
-	//#pragma omp parallel for
-	unsigned int num_views = 0;
-	for (size_t controlPacketIndex = 0; controlPacketIndex < numControls; ++controlPacketIndex)
-	{
-		const Acquisition::FrameControlPointer controlPacketAndFrameData = archiveStorage->NextFrameControl();
+		const long group = (pos[5] * numSlices + pos[2]) * numEchoes + pos[3];
 
-		if (controlPacketAndFrameData->Control().Opcode() == Acquisition::ProgrammableOpcode)
 		{
+			std::lock_guard<std::mutex> lock(locks[group]);
 
-			const Acquisition::ProgrammableControlPacket framePacket = controlPacketAndFrameData->Control().Packet().As<Acquisition::ProgrammableControlPacket>();
+			if (++placed[group] < numChannels)
+				return;
+		}
 
-			// Only include ImageFrames
-			viewValue = Acquisition::GetPacketValue(framePacket.viewNumH, framePacket.viewNumL);
-			frameType = viewValue == 0 ? Acquisition::BaselineFrame : Acquisition::ImageFrame;
+		pos[4] = 0;
 
-			if (frameType == Acquisition::ImageFrame) {
+		_Complex float* dst = (_Complex float*)((char*)out + md_calc_offset(N, ostrs, pos));
 
-				// If packet view number == 0, then this is a baseline view, else correct the baseline view number
-				viewIndex = viewValue == 0 ? 0 : viewValue - 1;
-				echoIndex = framePacket.echoNum;
-				sliceIndex = Acquisition::GetPacketValue(framePacket.sliceNumH, framePacket.sliceNumL);
+		long rdims[N];
+		md_select_dims(N, MD_BIT(0) | MD_BIT(4), rdims, sdims);
 
-				const ComplexFloatCube frameRawData = controlPacketAndFrameData->Data();
+		long rstrs[N];
+		md_calc_strides(N, rstrs, rdims, CFL_SIZE);
 
-				if (store_sequential) {
-					md_next(N, dims, ~(READ_FLAG | COIL_FLAG), pos); // FIXME: check this doesn't return false
-					//std::cout << "flag is " << flag << std::endl;
-				}
-				else {
+		_Complex float*& tmp = readouts[omp_get_thread_num()];
 
-					pos[1] = viewIndex;
-					pos[2] = sliceIndex;
-					pos[3] = echoIndex;
-					//pos[5] = currentPass; // FIXME: check for multiple passes
-				}
-				ComplexFloatMatrix oneReadout = frameRawData(all, all, 0); // is this "zero" the index for pass?
-				md_copy_block(N, pos, dims, out, dims1, oneReadout.data(), CFL_SIZE);
-				num_views++;
-			}
+		if (NULL == tmp)
+			tmp = (_Complex float*)md_alloc(N, rdims, CFL_SIZE);
+
+		for (long v = 0; v < sdims[1]; v++) {
+
+			_Complex float* vdst = (_Complex float*)((char*)dst + v * ostrs[1]);
+
+			md_copy2(N, rdims, rstrs, tmp, ostrs, vdst, CFL_SIZE);
+			BartIO::WhitenChannels(sdims[0], numChannels, ostrs[4] / CFL_SIZE, vdst, sdims[0], tmp, whitening);
 		}
-	}
+	};
 
-	return num_views;
-}
+	// I/O threads: fetch raw views or k-space of a block into the ring
+	const BartIO::BlockPipeline::Stage read = [&](long index, char* buffer) {
 
-/**
- * Extract Pfile data and copy to BART array
- * Assumes nothing about conventions of dimensions.
- * Limited to 6 dimensions because that's what the Pfile contains...
- */
-void BartIO::PfileToBart(const long dims[PFILE_DIMS], _Complex float* out, const Legacy::PfilePointer& pfile, const float pfileVersion)
-{
-	Trace trace("PfileToBart");
+		long pos[N];
+		PfileBlockPos(pos, sdims, index);
 
-	unsigned int N = PFILE_DIMS;
+		// position in the Pfile
+		for (unsigned int i = 0; i < N; i++)
+			pos[i] += sel.start[i];
 
-	// FIXME: check compatibility of pfile dimensions
-	// FIXME: check phases vs passes
+		int sl = pos[2];
 
-	const int numSlices = dims[2];
-	const int numEchoes = dims[3];
-	const int numChannels = dims[4];
-#if 0
-	const int numPhases = dims[5];
-#else
-	const int numPasses = dims[5];
-#endif
+		if (!zip_forward)
+			sl = numZipSlices - pos[2] - 1;
 
-	bool zip_on = false;
-	bool zip_forward = true;
+		if (rawData)
+			rawData->Copy(buffer, pos[5], sl, pos[3], pos[4]);
+		else
+			PfileReadBlock(dims1, (_Complex float*)buffer, pfile, rawData, pos[5], sl, pos[3], pos[4]);
+	};
 
-	const int numZipSlices = pfile->SliceCount();
+	// worker threads: convert and place the block in the output
+	const BartIO::BlockPipeline::Stage work = [&](long index, char* buffer) {
 
-	if (pfileVersion < 26.) {
+		long pos[N];
+		PfileBlockPos(pos, sdims, index);
 
-		// if ZIP is enabled, we have to figure out what side of the pfile was zero-padded.
-		zip_on = numSlices < numZipSlices;
-		zip_forward = zip_on ? BartIO::get_zip_dir(dims, pfile) : true;
-	}
+		if (!blockFFT && !coils) {
 
+			_Complex float* dst = (_Complex float*)((char*)out + md_calc_offset(N, ostrs, pos));
 
-	// copy into bart format and store in out
-#pragma omp parallel for collapse(4)
-	for (int currentPass = 0; currentPass < numPasses; currentPass++) {
+			if (rawData)
+				rawData->Convert(dst, ostrs, buffer);
+			else
+				md_copy2(N, dims1, ostrs, dst, strs1, buffer, CFL_SIZE);
 
-		for (int currentSlice = 0; currentSlice < numSlices; currentSlice++) {
+			whitenPlaced(pos);
+			return;
+		}
 
-			for (int currentEcho = 0; currentEcho < numEchoes; currentEcho++) {
+		_Complex float* block = (_Complex float*)buffer;
 
-				for (int currentChannel = 0; currentChannel < numChannels; currentChannel++) {
+		if (rawData) {
 
-					int sl = currentSlice;
+			_Complex float*& tmp = scratch[omp_get_thread_num()];
 
-					if (!zip_forward)
-						sl = numZipSlices - currentSlice - 1;
+			if (NULL == tmp)
+				tmp = (_Complex float*)md_alloc(N, dims1, CFL_SIZE);
 
-					ComplexFloatMatrix kSpace;
+			rawData->Convert(tmp, strs1, buffer);
+			block = tmp;
+		}
 
-					if (pfile->IsZEncoded()) {
-						
-						const ComplexFloatMatrix kSpace1 = pfile->KSpaceData<float>(Legacy::Pfile::PassSlicePair(currentPass, sl), currentEcho, currentChannel);
-						kSpace.reference(kSpace1);
-					}
-					else {
+		if (fused)
+			fused->Apply(block);
 
-						const ComplexFloatMatrix kSpace1 = pfile->KSpaceData<float>(sl, currentEcho, currentChannel, currentPass);
-						kSpace.reference(kSpace1);
-					}
+		if (!coils) {
 
-					long dims1[N];
-					BartIO::BartDims(dims1, kSpace);
-					assert(md_check_compat(N, ~(MD_BIT(0) | MD_BIT(1)), dims, dims1));
+			_Complex float* dst = (_Complex float*)((char*)out + md_calc_offset(N, ostrs, pos));
 
-					long pos[N];
-					md_set_dims(N, pos, 0);
-					pos[2] = currentSlice;
-					pos[3] = currentEcho;
-					pos[4] = currentChannel;
-					pos[5] = currentPass;
+			md_copy2(N, dims1, ostrs, dst, strs1, block, CFL_SIZE);
 
-					md_copy_block(N, pos, dims, out, dims1, kSpace.data(), CFL_SIZE);
-				}
-			}
+			whitenPlaced(pos);
+			return;
 		}
+
+		const long channel = pos[4];
+		pos[4] = 0;
+
+		_Complex float* dst = (_Complex float*)((char*)out + md_calc_offset(N, ostrs, pos));
+
+		std::lock_guard<std::mutex> lock(locks[(pos[5] * numSlices + pos[2]) * numEchoes + pos[3]]);
+
+		coils->Accumulate(channel, dims1, ostrs, ostrs[4], dst, strs1, block);
+	};
+
+	pipeline.Run(numBlocks, read, work);
+
+	for (size_t i = 0; i < scratch.size(); i++)
+		if (NULL != scratch[i])
+			md_free(scratch[i]);
+
+	for (size_t i = 0; i < readouts.size(); i++)
+		if (NULL != readouts[i])
+			md_free(readouts[i]);
+
+	// geometric compression works along Read in image space
+	if (coils && coils->Hybrid())
+		BartIO::FusedFFTApply(N, odims, ostrs, out, 0, 0, MD_BIT(0));
+
+	if ((0 != fftFlags) && !blockFFT)
+		BartIO::FusedFFTApply(N, odims, ostrs, out, options.fftmod_flags, options.ifft_flags, options.fft_flags);
+}
+
+
+/*
+ * Strides (bytes) of an Ox MDArray::Array, checked against bart dims
+ */
+static void OxStrides(long strs[PFILE_DIMS], const long dims[PFILE_DIMS], const Array<std::complex<float>,PFILE_DIMS>& a)
+{
+	for (int i = 0; i < PFILE_DIMS; i++) {
+
+		if (a.extent(i) != dims[i])
+			error("Array extent %d along dim %d does not match bart dims (%ld)\n", a.extent(i), i, dims[i]);
+
+		strs[i] = (1 == dims[i]) ? 0 : a.stride(i) * (long)CFL_SIZE;
 	}
 }
 
 
 /*
  * Convert bart array to Ox MDArray::Array
- * Assumes nothing about conventions of dimensions
+ * Assumes nothing about conventions of dimensions.
+ * The result is a column-major view of in, which must outlive it.
  */
-void BartIO::BartToOx(const long dims[DIMS], Array<std::complex<float>,PFILE_DIMS>& out, const _Complex float* in)
+void BartIO::BartToOx(const long dims[PFILE_DIMS], Array<std::complex<float>,PFILE_DIMS>& out, _Complex float* in)
 {
-#if 0
-	std::complex<float>* data = const_cast<std::complex<float>*>(reinterpret_cast<const std::complex<float>*>(in));
+	std::complex<float>* data = reinterpret_cast<std::complex<float>*>(in);
 
-	//FIXME: check if columnmajor is necessary?
-	out = Array<std::complex<float>,6>(data, shape(dims[READ_DIM], dims[PHS1_DIM], dims[PHS2_DIM], dims[COIL_DIM], dims[TE_DIM], dims[TIME_DIM]), duplicateData);
-#else
-	md_copy(PFILE_DIMS, dims, out.data(), in, CFL_SIZE);
-#endif
+	out.reference(Array<std::complex<float>,PFILE_DIMS>(data, shape(dims[0], dims[1], dims[2], dims[3], dims[4], dims[5]), neverDeleteData, ColumnMajorArray<PFILE_DIMS>()));
 }
 
 
 
 /*
  * Convert Ox MDArray::Array to bart array
- * Assumes nothing about conventions of dimensions
+ * Assumes nothing about conventions of dimensions.
+ * Follows the storage order of the array.
+ */
+void BartIO::OxToBart(const long dims[PFILE_DIMS], _Complex float* out, const Array<std::complex<float>,PFILE_DIMS>& in)
+{
+	long istrs[PFILE_DIMS];
+	OxStrides(istrs, dims, in);
+
+	long ostrs[PFILE_DIMS];
+	md_calc_strides(PFILE_DIMS, ostrs, dims, CFL_SIZE);
+
+	md_copy2(PFILE_DIMS, dims, ostrs, out, istrs, in.data(), CFL_SIZE);
+}
+
+
+/*
+ * View of an Ox MDArray::Array as bart array
+ * Only contiguous column-major storage has the bart layout.
  */
-void BartIO::OxToBart(const long dims[DIMS], _Complex float* out, const Array<std::complex<float>,PFILE_DIMS>& in)
+_Complex float* BartIO::OxToBartView(const long dims[PFILE_DIMS], Array<std::complex<float>,PFILE_DIMS>& in)
 {
-	//assert(md_calc_size(DIMS - PFILE_DIMS, dims + PFILE_DIMS) == 1);
-	//FIXME: check if columnmajor is necessary?
-	md_copy(DIMS, dims, out, in.data(), CFL_SIZE);
+	long istrs[PFILE_DIMS];
+	OxStrides(istrs, dims, in);
+
+	long strs[PFILE_DIMS];
+	md_calc_strides(PFILE_DIMS, strs, dims, CFL_SIZE);
+
+	for (int i = 0; i < PFILE_DIMS; i++)
+		if ((1 != dims[i]) && (istrs[i] != strs[i]))
+			error("Array storage is not contiguous column-major along dim %d (stride %ld, expected %ld)\n", i, istrs[i], strs[i]);
+
+	return reinterpret_cast<_Complex float*>(in.data());
 }
 
 
@@ -391,15 +1562,12 @@ static int ImageNumber(const int slice, const int echo, const int phase, const L
 /*
  * Apply ZIP and Z-transform
  */
-void BartIO::BartZipAndZTransform(const long dims_zip[DIMS], _Complex float* ksp_zip, const long dims[DIMS], const _Complex float* ksp, const bool zip_forward, const Legacy::PfilePointer& pfile)
+void BartIO::BartZipAndZTransform(const long dims_zip[DIMS], _Complex float* ksp_zip, const long dims[DIMS], const _Complex float* ksp, const bool zip_forward, const Legacy::PfilePointer& pfile, const Control::ProcessingControlPointer& processingControl)
 {
 	TracePointer trace = Trace::Instance();
 
 	//debug_print_dims(DP_INFO, DIMS, dims);
 
-	// Create a ProcessingControl from the Legacy Pfile.
-	const Control::ProcessingControlPointer processingControl = pfile->CreateOrchestraProcessingControl();
-
 	int numPhases = dims[TIME_DIM];
 	int numEchoes = dims[TE_DIM];
 	int numChannels = dims[COIL_DIM];
@@ -409,6 +1577,15 @@ void BartIO::BartZipAndZTransform(const long dims_zip[DIMS], _Complex float* ksp
 
 	trace->ConsoleMsg("Running Z-Transform and Filter");
 
+	long dims3d[DIMS];
+	md_select_dims(DIMS, FFT_FLAGS, dims3d, dims);
+
+	long dims3d_zip[DIMS];
+	md_select_dims(DIMS, FFT_FLAGS, dims3d_zip, dims_zip);
+
+	// ZTransformer and volumes are reused by every thread
+	BartIO::ReconEnginePool engines(processingControl, dims, dims_zip, dims_zip[0], dims_zip[1]);
+
 #pragma omp parallel for collapse(3)
 	for (int currentPhase = 0; currentPhase < numPhases; ++currentPhase)
 	{
@@ -419,48 +1596,79 @@ void BartIO::BartZipAndZTransform(const long dims_zip[DIMS], _Complex float* ksp
 			for (int currentChannel = 0; currentChannel < numChannels; ++currentChannel)
 			{
 
-				Cartesian3D::ZTransformer zTransformer(*processingControl);
-
-				long dims3d[DIMS];
-				md_select_dims(DIMS, FFT_FLAGS, dims3d, dims);
-
-				long dims3d_zip[DIMS];
-				md_select_dims(DIMS, FFT_FLAGS, dims3d_zip, dims_zip);
+				BartIO::ReconEngine& engine = engines.Local();
 
 				long pos[DIMS];
 				md_set_dims(DIMS, pos, 0); 
 
-				ComplexFloatCube acqKSpaceVol(dims[0], dims[1], dims[2]);
-				ComplexFloatCube zipKSpaceVol(dims_zip[0], dims_zip[1], dims_zip[2]);
-
 				pos[COIL_DIM] = currentChannel;
 				pos[TE_DIM] = currentEcho;
 				pos[TIME_DIM] = currentPhase;
 
-				md_copy_block(DIMS, pos, dims3d, acqKSpaceVol.data(), dims, ksp, CFL_SIZE);
+				md_copy_block(DIMS, pos, dims3d, engine.AcqKSpaceVol().data(), dims, ksp, CFL_SIZE);
 
 				// IFFT in Z direction. Data will be zipped from acquired size.
-				zTransformer.Apply(zipKSpaceVol, acqKSpaceVol);
+				engine.ZTransformer().Apply(engine.ZipKSpaceVol(), engine.AcqKSpaceVol());
 
-				md_copy_block(DIMS, pos, dims_zip, ksp_zip, dims3d_zip, zipKSpaceVol.data(), CFL_SIZE);
+				md_copy_block(DIMS, pos, dims_zip, ksp_zip, dims3d_zip, engine.ZipKSpaceVol().data(), CFL_SIZE);
 			}
 		}
 	}
 }
 
 
+/*
+ * Magnitude of the combination of partial channel combiners. Each partial
+ * holds the root of a sum of squares over its channels, so the squares of
+ * the partials are summed pairwise in a tree before taking the root.
+ */
+static void ReduceSumOfSquares(FloatMatrix& magnitudeImage, const std::vector<boost::shared_ptr<SumOfSquares> >& partials)
+{
+	const long numPartials = partials.size();
+	const long size = magnitudeImage.size();
+
+	assert(numPartials > 0);
+
+	std::vector<std::vector<float> > sums(numPartials);
+
+#pragma omp parallel for
+	for (long i = 0; i < numPartials; i++) {
+
+		const ComplexFloatMatrix combinedImage = partials[i]->GetCombinedImage();
+		const _Complex float* partial = (const _Complex float*)combinedImage.data();
+
+		assert(combinedImage.size() == size);
+
+		sums[i].resize(size);
+
+		for (long k = 0; k < size; k++)
+			sums[i][k] = __real__ partial[k] * __real__ partial[k] + __imag__ partial[k] * __imag__ partial[k];
+	}
+
+	for (long stride = 1; stride < numPartials; stride *= 2) {
+
+#pragma omp parallel for
+		for (long i = 0; i < numPartials - stride; i += 2 * stride)
+			for (long k = 0; k < size; k++)
+				sums[i][k] += sums[i + stride][k];
+	}
+
+	float* magnitude = magnitudeImage.data();
+
+	for (long k = 0; k < size; k++)
+		magnitude[k] = sqrtf(sums[0][k]);
+}
+
+
 /*
  * Write BART ksp file to dicoms using Pfile for auxiliary info
  */
-void BartIO::BartToDicom(const long dims[DIMS], const std::string& fileNamePrefix, const boost::optional<int>& seriesNumber, const boost::optional<std::string>& seriesDescription, const GEDicom::NetworkPointer& dicomNetwork, const _Complex float* ksp, const Legacy::PfilePointer& pfile, const float pfileVersion, const _Complex float* channel_weights)
+void BartIO::BartToDicom(const long dims[DIMS], const std::string& fileNamePrefix, const boost::optional<int>& seriesNumber, const boost::optional<std::string>& seriesDescription, const GEDicom::NetworkPointer& dicomNetwork, const _Complex float* ksp, const Legacy::PfilePointer& pfile, const Control::ProcessingControlPointer& processingControl, const float pfileVersion, const _Complex float* channel_weights, const std::string& multiFrame)
 {
 	TracePointer trace = Trace::Instance();
 
 	//debug_print_dims(DP_INFO, DIMS, dims);
 
-	// Create a ProcessingControl from the Legacy Pfile.
-	const Control::ProcessingControlPointer processingControl = pfile->CreateOrchestraProcessingControl();
-
 	// Pull info directly out of ProcessingControl    
 	const int imageXRes = processingControl->Value<int>("ImageXRes");
 	const int imageYRes = processingControl->Value<int>("ImageYRes");
@@ -525,83 +1733,256 @@ void BartIO::BartToDicom(const long dims[DIMS], const std::string& fileNamePrefi
 	md_select_dims(DIMS, ~PHS2_FLAG, dims_zip, dims);
 	dims_zip[PHS2_DIM] = numZipSlices;
 
-	trace->ConsoleMsg("Running Z-Transform and Filter");
+	// Slabs of one phase and echo are Z-transformed a group of channels at
+	// a time, and the slices of a group are handed to the 2D transform right
+	// away. Only one slab is held in memory, and the images of a phase and
+	// echo are written as soon as its last group is done.
+	//
+	// With fewer slices than threads, all channels form one group and the
+	// channels of each slice are transformed in parallel instead, combined
+	// by per-thread partial channel combiners.
+	const int numThreads = omp_get_max_threads();
+	const bool channelParallel = numZipSlices < numThreads;
+	const int groupSize = channelParallel ? numChannels : std::min(numChannels, numThreads);
+
+	long dims_slab[DIMS];
+	md_select_dims(DIMS, FFT_FLAGS, dims_slab, dims_zip);
+	dims_slab[COIL_DIM] = groupSize;
+
+	_Complex float* slab = (_Complex float*)md_alloc(DIMS, dims_slab, CFL_SIZE);
+
+	long dims3d[DIMS];
+	md_select_dims(DIMS, FFT_FLAGS, dims3d, dims);
+
+	long dims3d_zip[DIMS];
+	md_select_dims(DIMS, FFT_FLAGS, dims3d_zip, dims_zip);
+
+	long dims0[DIMS];
+	md_select_dims(DIMS, READ_FLAG | PHS1_FLAG, dims0, dims_slab);
+
+	// transformers, gradwarp and buffers are set up once per thread
+	BartIO::ReconEnginePool engines(processingControl, dims, dims_zip, imageXRes, imageYRes);
 
-	// FIXME: wasteful in memory
-	_Complex float* ksp_zip = (_Complex float*)md_alloc(DIMS, dims_zip, CFL_SIZE);
+	// files are saved and sent while the next images are computed
+	BartIO::DicomWriter writer(dicomNetwork, BartIO::DicomWriter::GroupingFromString(multiFrame), fileNamePrefix, numZipSlices, numEchoes, numPhases);
 
-	BartIO::BartZipAndZTransform(dims_zip, ksp_zip, dims, ksp, zip_forward, pfile);
+	// one channel combiner per slice, accumulated over the channel groups,
+	// or one per thread for a slice when channels run in parallel
+	std::vector<boost::shared_ptr<SumOfSquares> > channelCombiners(channelParallel ? numThreads : numZipSlices);
 
+	for(size_t i = 0; i < channelCombiners.size(); ++i)
+		channelCombiners[i].reset(new SumOfSquares(channelWeights));
 
 	trace->ConsoleMsg("Writing %d slices to Dicom...", numZipSlices);
 
-#pragma omp parallel for collapse(3)
-	for(int currentSlice = 0; currentSlice < numZipSlices; ++currentSlice)
+	for(int currentPhase = 0; currentPhase < numPhases; ++currentPhase)
 	{
 
-		for(int currentPhase = 0; currentPhase < numPhases; ++currentPhase)
+		for(int currentEcho = 0; currentEcho < numEchoes; ++currentEcho)
 		{
 
-			for(int currentEcho = 0; currentEcho < numEchoes; ++currentEcho)
+			// Zero out channel combiner buffers for the next set of channels.
+			for(size_t i = 0; i < channelCombiners.size(); ++i)
+				channelCombiners[i]->Reset();
+
+			for(int firstChannel = 0; firstChannel < numChannels; firstChannel += groupSize)
 			{
 
-				// initialize these here for OMP parallel threads
+				const int numGroupChannels = std::min(groupSize, numChannels - firstChannel);
+
+#pragma omp parallel for
+				for (int groupChannel = 0; groupChannel < numGroupChannels; ++groupChannel)
+				{
 
-				// Storage for transformed image data, thus the image sizes.
-				ComplexFloatMatrix imageData(imageXRes, imageYRes);
+					BartIO::ReconEngine& engine = engines.Local();
 
-				Cartesian2D::KSpaceTransformer transformer(*processingControl);
+					long pos[DIMS];
+					md_set_dims(DIMS, pos, 0);
 
-				// Create channel combiner object that will do the channel combining work in channel loop.
-				SumOfSquares channelCombiner(channelWeights);
+					pos[COIL_DIM] = firstChannel + groupChannel;
+					pos[TE_DIM] = currentEcho;
+					pos[TIME_DIM] = currentPhase;
 
-				// Gradwarp Plugin
-				GradwarpPlugin gradwarp(*processingControl, TwoDGradwarp, XRMBGradient);   
+					md_copy_block(DIMS, pos, dims3d, engine.AcqKSpaceVol().data(), dims, ksp, CFL_SIZE);
 
-				long dims0[DIMS];
-				md_select_dims(DIMS, READ_FLAG | PHS1_FLAG, dims0, dims_zip);
+					// IFFT in Z direction. Data will be zipped from acquired size.
+					engine.ZTransformer().Apply(engine.ZipKSpaceVol(), engine.AcqKSpaceVol());
 
-				long pos[DIMS];
-				md_set_dims(DIMS, pos, 0); 
+					md_set_dims(DIMS, pos, 0);
+					pos[COIL_DIM] = groupChannel;
 
-				// Zero out channel combiner buffer for the next set of channels.
-				channelCombiner.Reset();
+					md_copy_block(DIMS, pos, dims_slab, slab, dims3d_zip, engine.ZipKSpaceVol().data(), CFL_SIZE);
+				}
+
+				if (channelParallel)
+					continue;
 
-				for(int currentChannel = 0; currentChannel < numChannels; ++currentChannel)
+#pragma omp parallel for
+				for(int currentSlice = 0; currentSlice < numZipSlices; ++currentSlice)
 				{
-					//trace->ConsoleMsg("Processing Slice[%d of %d], Echo[%d of %d], Channel[%d of %d]", currentSlice+1, numZipSlices, currentEcho+1, numEchoes, currentChannel+1, numChannels);
 
-					// extract single slice of k-space
-					ComplexFloatMatrix kSpace0(dims_zip[0], dims_zip[1]);
+					BartIO::ReconEngine& engine = engines.Local();
 
-					pos[PHS2_DIM] = currentSlice;
-					pos[COIL_DIM] = currentChannel;
-					pos[TE_DIM] = currentEcho;
-					pos[TIME_DIM] = currentPhase;
+					long pos[DIMS];
+					md_set_dims(DIMS, pos, 0);
+
+					for(int groupChannel = 0; groupChannel < numGroupChannels; ++groupChannel)
+					{
+
+						// extract single slice of k-space
+						pos[PHS2_DIM] = currentSlice;
+						pos[COIL_DIM] = groupChannel;
+
+						md_copy_block(DIMS, pos, dims0, engine.KSpace0().data(), dims_slab, slab, CFL_SIZE);
+
+						// Transform to image space. Data will be zipped from acquired size.
+						engine.KSpaceTransformer().Apply(engine.ImageData(), engine.KSpace0());
+
+						// Accumulate Channel data in channel combiner.
+						channelCombiners[currentSlice]->Accumulate(engine.ImageData(), firstChannel + groupChannel);
+					}
+				}
+			}
+
+			if (channelParallel) {
+
+				for(int currentSlice = 0; currentSlice < numZipSlices; ++currentSlice)
+				{
+
+					std::vector<char> used(numThreads, 0);
 
-					md_copy_block(DIMS, pos, dims0, kSpace0.data(), dims_zip, ksp_zip, CFL_SIZE);
+#pragma omp parallel for schedule(dynamic)
+					for(int currentChannel = 0; currentChannel < numChannels; ++currentChannel)
+					{
 
-					// Transform to image space. Data will be zipped from acquired size.
-					transformer.Apply(imageData, kSpace0);
+						BartIO::ReconEngine& engine = engines.Local();
+						const int thread = omp_get_thread_num();
 
-					// Accumulate Channel data in channel combiner.
-					channelCombiner.Accumulate(imageData, currentChannel);
+						long pos[DIMS];
+						md_set_dims(DIMS, pos, 0);
 
-					//debug_printf(DP_INFO, "slice %d\n", currentSlice);
+						pos[PHS2_DIM] = currentSlice;
+						pos[COIL_DIM] = currentChannel;
+
+						md_copy_block(DIMS, pos, dims0, engine.KSpace0().data(), dims_slab, slab, CFL_SIZE);
+
+						engine.KSpaceTransformer().Apply(engine.ImageData(), engine.KSpace0());
+
+						// Accumulate Channel data in the partial combiner of this thread.
+						channelCombiners[thread]->Accumulate(engine.ImageData(), currentChannel);
+						used[thread] = 1;
+					}
+
+					std::vector<boost::shared_ptr<SumOfSquares> > partials;
+
+					for(int i = 0; i < numThreads; ++i) {
+
+						if (used[i])
+							partials.push_back(channelCombiners[i]);
+					}
+
+					FloatMatrix magnitudeImage(imageXRes, imageYRes);
+					ReduceSumOfSquares(magnitudeImage, partials);
+
+					for(size_t i = 0; i < partials.size(); ++i)
+						partials[i]->Reset();
+
+					BartIO::OxImageToDicom(magnitudeImage, currentSlice, currentEcho, currentPhase, fileNamePrefix, seriesNumber, seriesDescription, dicomSeries, dicomNetwork, pfile, engines.Local().Gradwarp(), &writer);
 				}
 
-				ComplexFloatMatrix combinedImage = channelCombiner.GetCombinedImage();
+				continue;
+			}
+
+#pragma omp parallel for
+			for(int currentSlice = 0; currentSlice < numZipSlices; ++currentSlice)
+			{
+
+				BartIO::ReconEngine& engine = engines.Local();
+
+				ComplexFloatMatrix combinedImage = channelCombiners[currentSlice]->GetCombinedImage();
 
 				FloatMatrix magnitudeImage(combinedImage.shape());
-				MDArray::ComplexToReal(magnitudeImage, combinedImage, MDArray::MagnitudeData);
+				BartIO::MagnitudeKernel(magnitudeImage.data(), (const _Complex float*)combinedImage.data(), combinedImage.size());
+
+				BartIO::OxImageToDicom(magnitudeImage, currentSlice, currentEcho, currentPhase, fileNamePrefix, seriesNumber, seriesDescription, dicomSeries, dicomNetwork, pfile, engine.Gradwarp(), &writer);
+			}
+		}
+	}
+
+	md_free(slab);
+
+	writer.Finish();
+
+	trace->ConsoleMsg("...done!");
+}
+
+
+/*
+ * Write BART images to dicoms using Pfile for auxiliary info
+ */
+void BartIO::BartImageToDicom(const long dims[DIMS], const std::string& fileNamePrefix, const boost::optional<int>& seriesNumber, const boost::optional<std::string>& seriesDescription, const GEDicom::NetworkPointer& dicomNetwork, const _Complex float* img, const Legacy::PfilePointer& pfile, const Control::ProcessingControlPointer& processingControl, const float scale, const std::string& multiFrame)
+{
+	TracePointer trace = Trace::Instance();
+
+	const int imageXRes = processingControl->Value<int>("ImageXRes");
+	const int imageYRes = processingControl->Value<int>("ImageYRes");
+
+	// Create DICOM series to save images into
+	const Legacy::DicomSeries dicomSeries(pfile);
+
+	const int numSlices = dims[PHS2_DIM];
+	const int numPhases = dims[TIME_DIM];
+	const int numEchoes = dims[TE_DIM];
+
+	if ((imageXRes != dims[READ_DIM]) || (imageYRes != dims[PHS1_DIM]))
+		error("Image size %ld x %ld does not match the Dicom image size %d x %d!\n", dims[READ_DIM], dims[PHS1_DIM], imageXRes, imageYRes);
+
+	if (1 != dims[COIL_DIM])
+		error("Images must be coil-combined!\n");
+
+	if (numSlices != pfile->SliceCount())
+		error("Number of slices %d does not match the Pfile (%d)!\n", numSlices, pfile->SliceCount());
+
+	long strs[DIMS];
+	md_calc_strides(DIMS, strs, dims, CFL_SIZE);
+
+	const long imageSize = dims[READ_DIM] * dims[PHS1_DIM];
+
+	// only the gradwarp of each thread's engine is used, and created on first use
+	BartIO::ReconEnginePool engines(processingControl, dims, dims, imageXRes, imageYRes);
+
+	BartIO::DicomWriter writer(dicomNetwork, BartIO::DicomWriter::GroupingFromString(multiFrame), fileNamePrefix, numSlices, numEchoes, numPhases);
+
+	trace->ConsoleMsg("Writing %d slices to Dicom...", numSlices);
+
+#pragma omp parallel for collapse(3)
+	for(int currentPhase = 0; currentPhase < numPhases; ++currentPhase)
+	{
+
+		for(int currentEcho = 0; currentEcho < numEchoes; ++currentEcho)
+		{
+
+			for(int currentSlice = 0; currentSlice < numSlices; ++currentSlice)
+			{
+
+				long pos[DIMS];
+				md_set_dims(DIMS, pos, 0);
+
+				pos[PHS2_DIM] = currentSlice;
+				pos[TE_DIM] = currentEcho;
+				pos[TIME_DIM] = currentPhase;
 
-				BartIO::OxImageToDicom(magnitudeImage, currentSlice, currentEcho, currentPhase, fileNamePrefix, seriesNumber, seriesDescription, dicomSeries, dicomNetwork, pfile, gradwarp);
+				const _Complex float* image = (const _Complex float*)((const char*)img + md_calc_offset(DIMS, strs, pos));
 
+				FloatMatrix magnitudeImage(imageXRes, imageYRes);
+				BartIO::MagnitudeKernel(magnitudeImage.data(), image, imageSize, scale);
+
+				BartIO::OxImageToDicom(magnitudeImage, currentSlice, currentEcho, currentPhase, fileNamePrefix, seriesNumber, seriesDescription, dicomSeries, dicomNetwork, pfile, engines.Local().Gradwarp(), &writer);
 			}
 		}
 	}
 
-	md_free(ksp_zip);
+	writer.Finish();
 
 	trace->ConsoleMsg("...done!");
 }
@@ -610,7 +1991,7 @@ void BartIO::BartToDicom(const long dims[DIMS], const std::string& fileNamePrefi
 /*
  * Write Ox Image dicoms using Pfile for auxiliary info
  */
-void BartIO::OxImageToDicom(MDArray::FloatMatrix& magnitudeImage, const int currentSlice, const int currentEcho, const int currentPhase, const std::string& fileNamePrefix, const boost::optional<int>& seriesNumber, const boost::optional<std::string>& seriesDescription, const Legacy::DicomSeries& dicomSeries, const GEDicom::NetworkPointer& dicomNetwork, const Legacy::PfilePointer& pfile, GradwarpPlugin& gradwarp)
+void BartIO::OxImageToDicom(MDArray::FloatMatrix& magnitudeImage, const int currentSlice, const int currentEcho, const int currentPhase, const std::string& fileNamePrefix, const boost::optional<int>& seriesNumber, const boost::optional<std::string>& seriesDescription, const Legacy::DicomSeries& dicomSeries, const GEDicom::NetworkPointer& dicomNetwork, const Legacy::PfilePointer& pfile, GradwarpPlugin& gradwarp, DicomWriter* writer)
 {
 	// Get information for current slice
 	const SliceOrientation& sliceOrientation = pfile->Orientation(currentSlice);
@@ -618,12 +1999,11 @@ void BartIO::OxImageToDicom(MDArray::FloatMatrix& magnitudeImage, const int curr
 
 	gradwarp.Run(magnitudeImage, sliceCorners, currentSlice);
 
-	FloatMatrix rotatedImage = RotateTranspose::Apply<float>(magnitudeImage, sliceOrientation.RotationType(), sliceOrientation.TransposeType());
-
-	Clipper::Apply(rotatedImage, MagnitudeImage);
-	ShortMatrix finalImage(rotatedImage.shape());
+	// rotate/transpose, clip and convert to short in one pass
+	const BartIO::RotateTransposeTable& table = BartIO::RotateTransposeIndex(magnitudeImage.extent(0), magnitudeImage.extent(1), sliceOrientation);
 
-	finalImage = MDArray::cast<short>(rotatedImage);
+	ShortMatrix finalImage(table.shape);
+	BartIO::RotateClipKernel(finalImage, magnitudeImage, table);
 
 	// Create DICOM image
 	const int imageNumber = ImageNumber(currentSlice, currentEcho, currentPhase, pfile);
@@ -639,6 +2019,13 @@ void BartIO::OxImageToDicom(MDArray::FloatMatrix& magnitudeImage, const int curr
 	// Save DICOM to file and also store it if network is active
 	std::ostringstream strm;
 	strm << fileNamePrefix << imageNumber << ".dcm";
+
+	if (NULL != writer) {
+
+		writer->Submit(dicom, strm.str(), currentSlice, currentEcho, currentPhase);
+		return;
+	}
+
 	dicom->Save(strm.str());
 	dicom->Store(dicomNetwork);
 }
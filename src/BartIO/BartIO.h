@@ -6,6 +6,12 @@
 
 #pragma once
 
+#include <functional>
+#include <string>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+
 #include <MDArray/MDArray.h>
 #include "misc/mri.h"
 
@@ -26,9 +32,18 @@ namespace GERecon
 		typedef boost::shared_ptr<Pfile> PfilePointer;
 	}
 
+	namespace Control
+	{
+		class ProcessingControl;
+		typedef boost::shared_ptr<ProcessingControl> ProcessingControlPointer;
+	}
+
 
 	namespace BartIO
 	{
+		class CoilCompression;
+		class DicomWriter;
+
 
 		/**
 		 * Copy bart dims from Array dims
@@ -52,18 +67,34 @@ namespace GERecon
 		 * @param odims Output dims: [Read, Phs1, Phs2, Coil, 1, TE, 1, 1, 1, 1, Phase]
 		 * @param odata output data after transposing
 		 * @param idims Input dims:  [Read, Phs1, Phs2, TE, Coil, Phase]
-		 * @param idata input data
+		 * @param idata input data. May be the same as odata
 		 */
 		void FormatBartMRI(long odims[DIMS], _Complex float* odata, const long idims[PFILE_DIMS], const _Complex float* idata);
 
 
+		/**
+		 * Strides of an array in bart mri convention, listed in Pfile dimension order.
+		 * Writing with these strides places Pfile-ordered data directly in bart order.
+		 *
+		 * @param ostrs Output strides (bytes) for [Read, Phs1, Phs2, TE, Coil, Phase]
+		 * @param odims Dims of the bart array: [Read, Phs1, Phs2, Coil, 1, TE, 1, 1, 1, 1, Phase]
+		 */
+		void FormatBartMRIStrides(long ostrs[PFILE_DIMS], const long odims[DIMS]);
+
+
+		/**
+		 * Map flags over Pfile dimensions to the corresponding bart mri dimensions
+		 */
+		unsigned long FormatBartMRIFlags(unsigned long flags);
+
+
 		/**
 		 * Tranpose dimension and data arrays to match Orchestra mri convention
 		 *
 		 * @param odims Output dims:  [Read, Phs1, Phs2, TE, Coil, Phase]
 		 * @param odata output data after transposing
 		 * @param idims Input dims: [Read, Phs1, Phs2, Coil, 1, TE, 1, 1, 1, 1, Phase]
-		 * @param idata input data
+		 * @param idata input data. May be the same as odata if there are no maps
 		 */
 		void FormatOxMRI(long odims[PFILE_DIMS], _Complex float* odata, const long idims[DIMS], const _Complex float* idata);
 
@@ -74,11 +105,133 @@ namespace GERecon
 		 */
 		bool get_zip_dir(const long dims[PFILE_DIMS], const Legacy::PfilePointer& pfile);
 
+		/**
+		 * Selected range [start, end) of each of the Pfile dimensions
+		 */
+		struct Selection
+		{
+			/**
+			 * Select everything
+			 */
+			Selection();
+
+			/**
+			 * Select a range given as "a:b" (a ... b - 1), "a:", ":b" or "a"
+			 */
+			void Select(const int dim, const std::string& range);
+
+			/**
+			 * Dims of the selection within an array of full dims
+			 */
+			void Dims(long sdims[PFILE_DIMS], const long dims[PFILE_DIMS]) const;
+
+			bool Contains(const int dim, const long index) const;
+
+			long start[PFILE_DIMS];
+
+			// -1: up to the full size
+			long end[PFILE_DIMS];
+		};
+
+
 		/**
 		 * Extract ScanArchive data and copy to BART array
 		 * Assumes nothing about conventions of dimensions.
+		 * Uses the packet index of the archive if there is one and builds it
+		 * otherwise, see ScanArchiveBuildIndex.
+		 *
+		 * @param dims full dims. The output has the dims of the selection
+		 * @param whitening if given, [Coil, Coil] matrix mixing the selected channels of each readout as it is placed
+		 */
+		long ScanArchiveToBart(const long dims[PFILE_DIMS], _Complex float* out, const ScanArchivePointer scanArchive, bool store_sequential, const Selection& selection = Selection(), const _Complex float* whitening = NULL);
+
+
+		/**
+		 * Extract ScanArchive data and copy to a strided BART array
+		 *
+		 * @param ostrs output strides (bytes) for each of the Pfile dimensions
+		 * @param coils if given, each readout is compressed into the virtual coils as it is placed,
+		 *  in hybrid space for geometric compression. Whitening is then part of the compression
+		 */
+		long ScanArchiveToBart2(const long dims[PFILE_DIMS], const long ostrs[PFILE_DIMS], _Complex float* out, const ScanArchivePointer scanArchive, bool store_sequential, const Selection& selection = Selection(), const _Complex float* whitening = NULL, const CoilCompression* coils = NULL);
+
+
+		/**
+		 * Extract the calibration region of the ScanArchive data for coil
+		 * compression. Only the frames of the region are decoded.
+		 *
+		 * @param caldims calibration dims within the stored selection, see CoilCompression::CalibrationDims
+		 * @param dims full dims, as for ScanArchiveToBart
+		 */
+		void ScanArchiveCalibration(const long caldims[PFILE_DIMS], _Complex float* cal, const long dims[PFILE_DIMS], const ScanArchivePointer scanArchive, bool store_sequential, const Selection& selection = Selection());
+
+
+		/**
+		 * Number of image frames of the selected slices and echoes, i.e. the
+		 * number of views stored in sequential mode, from the packet index.
+		 *
+		 * @return -1 if the archive has no valid index of all its control packets
+		 */
+		long ScanArchiveFrameCount(const ScanArchivePointer scanArchive, const Selection& selection = Selection());
+
+
+		/**
+		 * Selected frames of a ScanArchive in order of acquisition. Each frame
+		 * is a [Read, Coil] readout; chunks hold a fixed number of frames.
+		 */
+		typedef std::vector<std::vector<_Complex float> > FrameChunks;
+
+
+		/**
+		 * Read the selected frames of a ScanArchive in a single pass, for
+		 * sequential mode when their number is not known from an index.
+		 * Builds the index on the way.
+		 *
+		 * @param dims full dims
+		 * @param whitening if given, [Coil, Coil] matrix mixing the selected channels of each readout
+		 * @return number of frames
+		 */
+		long ScanArchiveReadFrames(FrameChunks& chunks, const long dims[PFILE_DIMS], const ScanArchivePointer scanArchive, const Selection& selection = Selection(), const _Complex float* whitening = NULL);
+
+
+		/**
+		 * Copy frames from ScanArchiveReadFrames to a strided BART array
+		 *
+		 * @param dims [Read, Frames, 1, 1, Coil, 1]
+		 * @param ostrs output strides (bytes) for each of the Pfile dimensions
+		 * @param coils if given, frames are compressed as by ScanArchiveToBart2
+		 */
+		void CopyFrames(const long dims[PFILE_DIMS], const long ostrs[PFILE_DIMS], _Complex float* out, const FrameChunks& chunks, const CoilCompression* coils = NULL);
+
+
+		/**
+		 * Copy the centered calibration region of frames from ScanArchiveReadFrames
+		 *
+		 * @param dims [Read, Frames, 1, 1, Coil, 1]
+		 */
+		void FramesCalibration(const long caldims[PFILE_DIMS], _Complex float* cal, const long dims[PFILE_DIMS], const FrameChunks& chunks);
+
+
+		/**
+		 * Follow a ScanArchive that is still being written. Selected frames
+		 * are collected in order of acquisition into blocks of blockViews
+		 * readouts [Read, Views, 1, 1, Coil, 1], and emit is called for every
+		 * full block and for the last partial one. Stops at the scan control
+		 * packet that ends the scan, not at those ending a pass, or once no
+		 * packets arrived for timeout seconds if the archive ends without one.
+		 *
+		 * @param dims full dims
+		 * @return number of frames
+		 */
+		long ScanArchiveFollow(const long dims[PFILE_DIMS], const ScanArchivePointer scanArchive, const Selection& selection, const long blockViews, const double timeout,
+				const std::function<void(long block, const long bdims[PFILE_DIMS], const long bstrs[PFILE_DIMS], const _Complex float* data)>& emit, const _Complex float* whitening = NULL);
+
+
+		/**
+		 * Write the packet index of a ScanArchive, used by ScanArchiveToBart
+		 * to place frames without decoding the control packets.
 		 */
-		long ScanArchiveToBart(const long dims[PFILE_DIMS], _Complex float* out, const ScanArchivePointer scanArchive, bool store_sequential);
+		void ScanArchiveBuildIndex(const ScanArchivePointer scanArchive);
 
 		/**
 		 * Extract Pfile data and copy to BART array
@@ -89,33 +242,140 @@ namespace GERecon
 
 
 		/**
-		 * Convert BART array to Orchestra array
+		 * Options for extracting Pfile data
+		 */
+		struct IngestOptions
+		{
+			IngestOptions();
+
+			/**
+			 * If given, the raw data region is memory-mapped and converted
+			 * directly, falling back to Pfile::KSpaceData if the raw layout is
+			 * not supported.
+			 */
+			boost::filesystem::path pfilePath;
+
+			/**
+			 * Number of I/O threads prefetching blocks for the conversion threads
+			 */
+			int numReaders;
+
+			/**
+			 * bart fftmod, fft -iu and fft -u flags over the Pfile dimensions, applied
+			 * in this order. Transforms along Read/Phs1 only are done on each block
+			 * while it is placed, others in one fused pass after reading.
+			 */
+			unsigned long fftmod_flags;
+			unsigned long ifft_flags;
+			unsigned long fft_flags;
+
+			/**
+			 * Blocks to extract. The output has the dims of the selection.
+			 */
+			Selection selection;
+
+			/**
+			 * If set, channels are compressed to virtual coils while they are
+			 * placed. The output has VirtualCount() coils and is compressed
+			 * before the transforms above. Whitening before compression is
+			 * part of the CoilCompression.
+			 */
+			boost::shared_ptr<const CoilCompression> coils;
+
+			/**
+			 * If given without coils, [Coil, Coil] whitening matrix of the
+			 * selected channels. Once all channels of a (pass, slice, echo) are
+			 * placed, each readout is mixed by a small GEMM (WhitenChannels).
+			 */
+			const _Complex float* whitening;
+		};
+
+
+		/**
+		 * Extract Pfile data and copy to a strided BART array
+		 *
+		 * @param dims full Pfile dims. The output has the dims of options.selection
+		 * @param ostrs output strides (bytes) for each of the Pfile dimensions
+		 */
+		void PfileToBart2(const long dims[PFILE_DIMS], const long ostrs[PFILE_DIMS], _Complex float* out, const Legacy::PfilePointer& pfile, const float pfileVersion = 0., const IngestOptions& options = IngestOptions());
+
+
+		/**
+		 * Extract Pfile data and scatter each readout directly into its
+		 * position in an array following the bart mri convention.
+		 * No intermediate copy of the k-space is made.
+		 *
+		 * @param odims Output dims of the selection: [Read, Phs1, Phs2, Coil, 1, TE, 1, 1, 1, 1, Phase]
+		 * @param dims full Pfile dims:  [Read, Phs1, Phs2, TE, Coil, Phase]
+		 */
+		void PfileToBartMRI(const long odims[DIMS], _Complex float* out, const long dims[PFILE_DIMS], const Legacy::PfilePointer& pfile, const float pfileVersion = 0., const IngestOptions& options = IngestOptions());
+
+
+		/**
+		 * Extract the calibration region of the Pfile data for coil compression
+		 *
+		 * @param caldims calibration dims within the selection, see CoilCompression::CalibrationDims
+		 * @param dims full Pfile dims:  [Read, Phs1, Phs2, TE, Coil, Phase]
+		 */
+		void PfileToBartCalibration(const long caldims[PFILE_DIMS], _Complex float* cal, const long dims[PFILE_DIMS], const Legacy::PfilePointer& pfile, const float pfileVersion = 0., const IngestOptions& options = IngestOptions());
+
+
+		/**
+		 * Convert BART array to Orchestra array. No data is copied: out
+		 * becomes a column-major view of in, which must outlive it. Writes
+		 * to out change in.
 		 */
-		void BartToOx(const long dims[PFILE_DIMS], MDArray::Array<std::complex<float>,PFILE_DIMS>& out, const _Complex float* in);
+		void BartToOx(const long dims[PFILE_DIMS], MDArray::Array<std::complex<float>,PFILE_DIMS>& out, _Complex float* in);
 
 
 		/**
-		 * Convert Orchestra array to BART array
+		 * Convert Orchestra array to BART array. Any storage order is copied
+		 * correctly.
 		 */
 		void OxToBart(const long dims[PFILE_DIMS], _Complex float* out, const MDArray::Array<std::complex<float>,PFILE_DIMS>& in);
 
 
+		/**
+		 * BART array sharing the data of an Orchestra array. Fails unless the
+		 * array has the dims and contiguous column-major storage.
+		 */
+		_Complex float* OxToBartView(const long dims[PFILE_DIMS], MDArray::Array<std::complex<float>,PFILE_DIMS>& in);
+
+
 		/**
 		 * Apply ZIP and Z transformer to BART kspace data
+		 *
+		 * @param processingControl processing control of the Pfile, e.g. from PfileProcessingControl
 		 */
-		void BartZipAndZTransform(const long dims_zip[DIMS], _Complex float* ksp_zip, const long dims[DIMS], const _Complex float* ksp, const bool zip_forward, const Legacy::PfilePointer& pfile);
+		void BartZipAndZTransform(const long dims_zip[DIMS], _Complex float* ksp_zip, const long dims[DIMS], const _Complex float* ksp, const bool zip_forward, const Legacy::PfilePointer& pfile, const Control::ProcessingControlPointer& processingControl);
 
 
 		/**
 		 * Write BART file to dicoms using pfile info
+		 *
+		 * @param processingControl processing control of the Pfile, e.g. from PfileProcessingControl
+		 * @param multiFrame none, or pack images into Enhanced MR objects per series or volume
+		 */
+		void BartToDicom(const long dims[DIMS], const std::string& fileNamePrefix, const boost::optional<int>& seriesNumber, const boost::optional<std::string>& seriesDescription, const GEDicom::NetworkPointer& dicomNetwork, const _Complex float* ksp, const Legacy::PfilePointer& pfile, const Control::ProcessingControlPointer& processingControl, const float pfileVersion = 0., const _Complex float* channel_weights = NULL, const std::string& multiFrame = "none");
+
+
+		/**
+		 * Write coil-combined BART images to dicoms using pfile info. The
+		 * magnitude of each slice goes straight to gradwarp, rotation and
+		 * clipping, without any transforms.
+		 *
+		 * @param dims [ImageXRes, ImageYRes, Slices, 1, 1, TE, ..., Phase]
+		 * @param processingControl processing control of the Pfile, e.g. from PfileProcessingControl
+		 * @param scale scaling of the magnitude before clipping
 		 */
-		void BartToDicom(const long dims[DIMS], const std::string& fileNamePrefix, const boost::optional<int>& seriesNumber, const boost::optional<std::string>& seriesDescription, const GEDicom::NetworkPointer& dicomNetwork, const _Complex float* ksp, const Legacy::PfilePointer& pfile, const float pfileVersion = 0., const _Complex float* channel_weights = NULL);
+		void BartImageToDicom(const long dims[DIMS], const std::string& fileNamePrefix, const boost::optional<int>& seriesNumber, const boost::optional<std::string>& seriesDescription, const GEDicom::NetworkPointer& dicomNetwork, const _Complex float* img, const Legacy::PfilePointer& pfile, const Control::ProcessingControlPointer& processingControl, const float scale = 1., const std::string& multiFrame = "none");
 
 
 /*
- * Write Ox Image dicoms using Pfile for auxiliary info
+ * Write Ox Image dicoms using Pfile for auxiliary info. With a writer, the
+ * image is saved and stored in the background.
  */
-		void OxImageToDicom(MDArray::FloatMatrix& magnitudeImage, const int currentSlice, const int currentEcho, const int currentPhase, const std::string& fileNamePrefix, const boost::optional<int>& seriesNumber, const boost::optional<std::string>& seriesDescription, const Legacy::DicomSeries& dicomSeries, const GEDicom::NetworkPointer& dicomNetwork, const Legacy::PfilePointer& pfile, GradwarpPlugin& gradwarp);
+		void OxImageToDicom(MDArray::FloatMatrix& magnitudeImage, const int currentSlice, const int currentEcho, const int currentPhase, const std::string& fileNamePrefix, const boost::optional<int>& seriesNumber, const boost::optional<std::string>& seriesDescription, const Legacy::DicomSeries& dicomSeries, const GEDicom::NetworkPointer& dicomNetwork, const Legacy::PfilePointer& pfile, GradwarpPlugin& gradwarp, DicomWriter* writer = NULL);
 
 	}
 }
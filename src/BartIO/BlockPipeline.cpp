@@ -0,0 +1,120 @@
+/* Copyright 2017. The Regents of the University of California.
+ * Copyright 2011-2017 General Electric Company. All rights reserved.
+ * GE Proprietary and Confidential Information. Only to be distributed with
+ * permission from GE. Resulting outputs are not for diagnostic purposes.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <utility>
+
+#include <omp.h>
+
+// includes for bart
+#include "num/multind.h"
+
+#include "BoundedQueue.h"
+#include "BlockPipeline.h"
+
+
+using namespace GERecon;
+
+
+BartIO::BlockPipeline::BlockPipeline(const size_t blockBytes, const int numReaders, const int numBuffers)
+	: numReaders(std::max(1, numReaders))
+{
+	const int count = (numBuffers > 0) ? numBuffers : 2 * omp_get_max_threads();
+	const long dims[1] = { (long)blockBytes };
+
+	for (int i = 0; i < std::max(2, count); i++)
+		buffers.push_back((char*)md_alloc(1, dims, 1));
+}
+
+
+BartIO::BlockPipeline::~BlockPipeline()
+{
+	for (size_t i = 0; i < buffers.size(); i++)
+		md_free(buffers[i]);
+}
+
+
+void BartIO::BlockPipeline::Run(const long numBlocks, const Stage& read, const Stage& work)
+{
+	typedef std::pair<long, char*> Block;
+
+	BoundedQueue<char*> freeBuffers(buffers.size());
+	BoundedQueue<Block> readyBlocks(buffers.size());
+
+	for (size_t i = 0; i < buffers.size(); i++)
+		freeBuffers.Push(buffers[i]);
+
+	std::atomic<long> nextBlock(0);
+	std::atomic<int> activeReaders(0);
+
+	std::exception_ptr error;
+
+#pragma omp parallel
+	{
+		const int numThreads = omp_get_num_threads();
+		const int id = omp_get_thread_num();
+
+		// with a single thread, read and process in turn
+		const int readers = (numThreads > 1) ? std::min(numReaders, numThreads - 1) : 0;
+
+#pragma omp single
+		activeReaders = readers;
+
+		try {
+
+			if (0 == readers) {
+
+				char* buffer = buffers[0];
+
+				for (long index = 0; index < numBlocks; index++) {
+
+					read(index, buffer);
+					work(index, buffer);
+				}
+
+			} else if (id < readers) {
+
+				long index;
+				char* buffer;
+
+				while (((index = nextBlock++) < numBlocks) && freeBuffers.Pop(buffer)) {
+
+					read(index, buffer);
+
+					if (!readyBlocks.Push(Block(index, buffer)))
+						break;
+				}
+
+				if (0 == --activeReaders)
+					readyBlocks.Close();
+
+			} else {
+
+				Block block;
+
+				while (readyBlocks.Pop(block)) {
+
+					work(block.first, block.second);
+					freeBuffers.Push(block.second);
+				}
+			}
+
+		} catch (...) {
+
+#pragma omp critical (BlockPipelineError)
+			if (!error)
+				error = std::current_exception();
+
+			freeBuffers.Close();
+			readyBlocks.Close();
+		}
+	}
+
+	if (error)
+		std::rethrow_exception(error);
+}
@@ -0,0 +1,59 @@
+/* Copyright 2017. The Regents of the University of California.
+ * Copyright 2011-2017 General Electric Company. All rights reserved.
+ * GE Proprietary and Confidential Information. Only to be distributed with
+ * permission from GE. Resulting outputs are not for diagnostic purposes.
+ */
+
+#pragma once
+
+#include <functional>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+
+
+namespace GERecon
+{
+	namespace BartIO
+	{
+
+		/**
+		 * Producer/consumer pipeline over a bounded ring of reusable block buffers.
+		 *
+		 * A few reader threads fill free buffers with blocks (e.g. file I/O) and
+		 * hand them to worker threads, which process and place the block and
+		 * return the buffer to the ring. Blocks are claimed in index order by
+		 * the readers. All threads are taken from the OpenMP thread pool.
+		 */
+		class BlockPipeline : private boost::noncopyable
+		{
+		public:
+
+			/**
+			 * Stage callback: (block index, block buffer)
+			 */
+			typedef std::function<void(long, char*)> Stage;
+
+			/**
+			 * @param blockBytes size of each block buffer
+			 * @param numReaders number of reader threads
+			 * @param numBuffers number of buffers in the ring. Default: two per thread
+			 */
+			BlockPipeline(const size_t blockBytes, const int numReaders, const int numBuffers = 0);
+
+			~BlockPipeline();
+
+			/**
+			 * Read and process blocks 0 ... numBlocks - 1. Exceptions thrown by
+			 * a stage stop the pipeline and are rethrown to the caller.
+			 */
+			void Run(const long numBlocks, const Stage& read, const Stage& work);
+
+		private:
+
+			const int numReaders;
+
+			std::vector<char*> buffers;
+		};
+	}
+}
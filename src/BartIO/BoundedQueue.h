@@ -0,0 +1,91 @@
+/* Copyright 2017. The Regents of the University of California.
+ * Copyright 2011-2017 General Electric Company. All rights reserved.
+ * GE Proprietary and Confidential Information. Only to be distributed with
+ * permission from GE. Resulting outputs are not for diagnostic purposes.
+ */
+
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+#include <boost/noncopyable.hpp>
+
+
+namespace GERecon
+{
+	namespace BartIO
+	{
+
+		/**
+		 * Blocking first-in first-out queue with a fixed capacity.
+		 * Push() waits while the queue is full and Pop() waits while it is
+		 * empty. After Close(), Push() fails and Pop() drains the remaining
+		 * items before failing.
+		 */
+		template<typename T>
+		class BoundedQueue : private boost::noncopyable
+		{
+		public:
+
+			explicit BoundedQueue(const size_t capacity)
+				: capacity(capacity), closed(false)
+			{
+			}
+
+			bool Push(const T& item)
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+
+				while (!closed && (items.size() >= capacity))
+					notFull.wait(lock);
+
+				if (closed)
+					return false;
+
+				items.push_back(item);
+				notEmpty.notify_one();
+
+				return true;
+			}
+
+			bool Pop(T& item)
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+
+				while (!closed && items.empty())
+					notEmpty.wait(lock);
+
+				if (items.empty())
+					return false;
+
+				item = items.front();
+				items.pop_front();
+				notFull.notify_one();
+
+				return true;
+			}
+
+			void Close()
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+
+				closed = true;
+				notEmpty.notify_all();
+				notFull.notify_all();
+			}
+
+		private:
+
+			const size_t capacity;
+			bool closed;
+
+			std::deque<T> items;
+
+			std::mutex mutex;
+			std::condition_variable notEmpty;
+			std::condition_variable notFull;
+		};
+	}
+}
@@ -0,0 +1,133 @@
+/* Copyright 2018. The Regents of the University of California.
+ * Copyright 2011-2018 General Electric Company. All rights reserved.
+ * GE Proprietary and Confidential Information. Only to be distributed with
+ * permission from GE. Resulting outputs are not for diagnostic purposes.
+ */
+
+#include <algorithm>
+#include <functional>
+
+#include <stdio.h>
+
+#include <Orchestra/Common/SliceCorners.h>
+
+// includes for bart
+#include <assert.h>
+
+#include "misc/mri.h"
+#include "misc/misc.h"
+#include "misc/mmio.h"
+#include "misc/debug.h"
+
+#include "num/multind.h"
+
+#include "CalibrationCache.h"
+
+
+using namespace GERecon;
+using namespace MDArray;
+
+
+static void AppendCorner(std::string& key, const FloatVector& corner)
+{
+	char buf[64];
+
+	for (int i = 0; i < 3; i++) {
+
+		// exact representation of the coordinate
+		snprintf(buf, sizeof(buf), " %a", corner(i));
+		key += buf;
+	}
+}
+
+
+BartIO::CalibrationCache::CalibrationCache(const boost::filesystem::path& directory)
+	: directory(directory)
+{
+	if (!directory.empty())
+		boost::filesystem::create_directories(directory);
+}
+
+
+std::string BartIO::CalibrationCache::Key(const boost::filesystem::path& calibrationFile, const int imageType, const long size[3],
+		const SliceCorners& firstSlice, const SliceCorners& lastSlice, const float scanCenter)
+{
+	char buf[256];
+
+	snprintf(buf, sizeof(buf), " %lu %ld %d %ld %ld %ld %a",
+		(unsigned long)boost::filesystem::file_size(calibrationFile),
+		(long)boost::filesystem::last_write_time(calibrationFile),
+		imageType, size[0], size[1], size[2], scanCenter);
+
+	std::string key = boost::filesystem::absolute(calibrationFile).string() + buf;
+
+	const SliceCorners* slices[2] = { &firstSlice, &lastSlice };
+
+	for (int i = 0; i < 2; i++) {
+
+		AppendCorner(key, slices[i]->UpperLeft());
+		AppendCorner(key, slices[i]->UpperRight());
+		AppendCorner(key, slices[i]->LowerLeft());
+	}
+
+	snprintf(buf, sizeof(buf), "calib_%016lx", (unsigned long)std::hash<std::string>()(key));
+
+	return buf;
+}
+
+
+BartIO::CalibrationCache::VolumePointer BartIO::CalibrationCache::Get(const std::string& key, const std::function<VolumePointer()>& compute)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+
+		std::map<std::string, VolumePointer>::const_iterator it = volumes.find(key);
+
+		if (volumes.end() != it)
+			return it->second;
+	}
+
+	VolumePointer volume;
+
+	const std::string name = (directory / key).string();
+
+	if (!directory.empty() && boost::filesystem::exists(name + ".hdr")) {
+
+		debug_printf(DP_DEBUG1, "Calibration volume from cache %s\n", name.c_str());
+
+		boost::shared_ptr<Volume> cached(new Volume);
+
+		_Complex float* data = load_cfl(name.c_str(), DIMS, cached->dims);
+
+		cached->data.assign(data, data + md_calc_size(DIMS, cached->dims));
+
+		unmap_cfl(DIMS, cached->dims, data);
+
+		volume = cached;
+
+	} else {
+
+		volume = compute();
+
+		if (!directory.empty()) {
+
+			// write under a temporary name, so other runs never see a partial volume
+			const std::string part = name + ".part";
+
+			_Complex float* data = create_cfl(part.c_str(), DIMS, volume->dims);
+
+			std::copy(volume->data.begin(), volume->data.end(), data);
+
+			unmap_cfl(DIMS, volume->dims, data);
+
+			boost::filesystem::rename(part + ".cfl", name + ".cfl");
+			boost::filesystem::rename(part + ".hdr", name + ".hdr");
+		}
+	}
+
+	std::lock_guard<std::mutex> lock(mutex);
+
+	volumes[key] = volume;
+
+	return volume;
+}
@@ -0,0 +1,75 @@
+/* Copyright 2018. The Regents of the University of California.
+ * Copyright 2011-2018 General Electric Company. All rights reserved.
+ * GE Proprietary and Confidential Information. Only to be distributed with
+ * permission from GE. Resulting outputs are not for diagnostic purposes.
+ */
+
+#pragma once
+
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include "misc/mri.h"
+
+
+namespace GERecon
+{
+	class SliceCorners;
+
+	namespace BartIO
+	{
+
+		/**
+		 * Calibration volumes interpolated to an imaging geometry, cached by
+		 * the geometry: calibration file, image type, matrix size, corners of
+		 * the first and last slice and scan center. Repeat series on the same
+		 * exam reuse the volumes of an earlier series.
+		 *
+		 * Volumes are kept in memory and, with a directory, as bart files
+		 * named by the key, so later runs find them too.
+		 */
+		class CalibrationCache : private boost::noncopyable
+		{
+		public:
+
+			struct Volume
+			{
+				long dims[DIMS];
+				std::vector<_Complex float> data;
+			};
+
+			typedef boost::shared_ptr<const Volume> VolumePointer;
+
+			/**
+			 * @param directory cache directory. Empty: memory only
+			 */
+			CalibrationCache(const boost::filesystem::path& directory = boost::filesystem::path());
+
+			/**
+			 * Key of a geometry. Changes when the calibration file does.
+			 */
+			static std::string Key(const boost::filesystem::path& calibrationFile, const int imageType, const long size[3],
+					const SliceCorners& firstSlice, const SliceCorners& lastSlice, const float scanCenter);
+
+			/**
+			 * Cached volume of key, or the volume made by compute on a miss.
+			 * Thread safe; compute runs without holding the cache.
+			 */
+			VolumePointer Get(const std::string& key, const std::function<VolumePointer()>& compute);
+
+		private:
+
+			boost::filesystem::path directory;
+
+			std::mutex mutex;
+			std::map<std::string, VolumePointer> volumes;
+		};
+	}
+}
@@ -0,0 +1,343 @@
+/* Copyright 2017. The Regents of the University of California.
+ * Copyright 2011-2017 General Electric Company. All rights reserved.
+ * GE Proprietary and Confidential Information. Only to be distributed with
+ * permission from GE. Resulting outputs are not for diagnostic purposes.
+ */
+
+#include <algorithm>
+
+#include <lapacke.h>
+
+// includes for bart
+#include <assert.h>
+#include <math.h>
+
+#include "misc/mri.h"
+#include "misc/misc.h"
+#include "misc/debug.h"
+
+#include "num/multind.h"
+#include "num/flpmath.h"
+#include "num/fft.h"
+
+#include "CoilCompression.h"
+#include "NoiseWhitening.h"
+
+
+using namespace GERecon;
+
+
+static inline _Complex float Conj(const _Complex float z)
+{
+	_Complex float r;
+	__real__ r = __real__ z;
+	__imag__ r = -__imag__ z;
+	return r;
+}
+
+
+/*
+ * Eigen decomposition of a Hermitian (column-major) matrix. Eigenvalues are
+ * returned in ascending order, eigenvectors in the columns of mat.
+ */
+static void HermitianEig(const long n, float* val, _Complex float* mat)
+{
+	if (0 != LAPACKE_cheev(LAPACK_COL_MAJOR, 'V', 'U', n, (lapack_complex_float*)mat, n, val))
+		error("Eigen decomposition failed!\n");
+}
+
+
+/*
+ * Rotate the virtual coils of u [Coil, Virtual] to best match ref: u <- u Q
+ * with Q = A (A^H A)^{-1/2}, A = u^H ref, the unitary minimizing |ref - u Q|.
+ */
+static void AlignTo(const long C, const long P, _Complex float* u, const _Complex float* ref)
+{
+	std::vector<_Complex float> A(P * P);
+
+	for (long i = 0; i < P; i++)
+		for (long j = 0; j < P; j++) {
+
+			_Complex float sum = 0.;
+
+			for (long c = 0; c < C; c++)
+				sum += Conj(u[i * C + c]) * ref[j * C + c];
+
+			A[i + P * j] = sum;
+		}
+
+	// B = A^H A = W diag(val) W^H
+	std::vector<_Complex float> W(P * P);
+
+	for (long i = 0; i < P; i++)
+		for (long j = 0; j < P; j++) {
+
+			_Complex float sum = 0.;
+
+			for (long k = 0; k < P; k++)
+				sum += Conj(A[k + P * i]) * A[k + P * j];
+
+			W[i + P * j] = sum;
+		}
+
+	std::vector<float> val(P);
+	HermitianEig(P, val.data(), W.data());
+
+	const float eps = 1.E-6 * std::max(val[P - 1], 0.f);
+
+	// Q = A W diag(val)^{-1/2} W^H
+	std::vector<_Complex float> AW(P * P);
+
+	for (long i = 0; i < P; i++)
+		for (long j = 0; j < P; j++) {
+
+			_Complex float sum = 0.;
+
+			for (long k = 0; k < P; k++)
+				sum += A[i + P * k] * W[k + P * j];
+
+			AW[i + P * j] = sum / sqrtf(std::max(val[j], eps));
+		}
+
+	std::vector<_Complex float> Q(P * P);
+
+	for (long i = 0; i < P; i++)
+		for (long j = 0; j < P; j++) {
+
+			_Complex float sum = 0.;
+
+			for (long k = 0; k < P; k++)
+				sum += AW[i + P * k] * Conj(W[j + P * k]);
+
+			Q[i + P * j] = sum;
+		}
+
+	std::vector<_Complex float> tmp(u, u + C * P);
+
+	for (long j = 0; j < P; j++)
+		for (long c = 0; c < C; c++) {
+
+			_Complex float sum = 0.;
+
+			for (long k = 0; k < P; k++)
+				sum += tmp[k * C + c] * Q[k + P * j];
+
+			u[j * C + c] = sum;
+		}
+}
+
+
+BartIO::CoilCompression::Type BartIO::CoilCompression::TypeFromString(const std::string& name)
+{
+	if ("svd" == name)
+		return SVD;
+
+	if ("geometric" == name)
+		return Geometric;
+
+	error("Unknown coil compression type %s!\n", name.c_str());
+	return SVD;
+}
+
+
+BartIO::CoilCompression::CoilCompression(const Type type, const long numVirtual, const long caldims[PFILE_DIMS], const _Complex float* cal, const _Complex float* whitening)
+	: numChannels(caldims[4]), numVirtual(numVirtual), numX((Geometric == type) ? caldims[0] : 1)
+{
+	const long C = numChannels;
+	const long P = numVirtual;
+
+	if ((P < 1) || (P > C))
+		error("Number of virtual coils (%ld) must be between 1 and %ld!\n", P, C);
+
+	assert((1 == caldims[3]) && (1 == caldims[5]));
+
+	// samples of each channel
+	const long L = caldims[0] * caldims[1] * caldims[2];
+
+	_Complex float* data = (_Complex float*)md_alloc(PFILE_DIMS, caldims, CFL_SIZE);
+
+	// compression is learned from the whitened channels
+	if (NULL != whitening)
+		BartIO::WhitenChannels(L, C, L, data, L, cal, whitening);
+	else
+		md_copy(PFILE_DIMS, caldims, data, cal, CFL_SIZE);
+
+	if (Geometric == type)
+		ifftuc(PFILE_DIMS, caldims, MD_BIT(0), data, data);
+
+	// principal components of the channel covariance, for each readout position
+	std::vector<_Complex float> U(numX * C * P);
+
+	for (long x = 0; x < numX; x++) {
+
+		std::vector<_Complex float> cov(C * C);
+
+#pragma omp parallel for
+		for (long c = 0; c < C; c++) {
+
+			for (long d = 0; d <= c; d++) {
+
+				_Complex double sum = 0.;
+
+				for (long i = x; i < L; i += numX)
+					sum += data[i + L * c] * Conj(data[i + L * d]);
+
+				cov[c + C * d] = sum;
+				cov[d + C * c] = Conj(cov[c + C * d]);
+			}
+		}
+
+		std::vector<float> val(C);
+		HermitianEig(C, val.data(), cov.data());
+
+		// eigenvalues are ascending
+		for (long v = 0; v < P; v++)
+			std::copy(&cov[C * (C - 1 - v)], &cov[C * (C - v)], &U[(x * P + v) * C]);
+	}
+
+	md_free(data);
+
+	// neighbouring readout positions must use consistent virtual coils
+	const long center = numX / 2;
+
+	for (long x = center + 1; x < numX; x++)
+		AlignTo(C, P, &U[x * P * C], &U[(x - 1) * P * C]);
+
+	for (long x = center - 1; x >= 0; x--)
+		AlignTo(C, P, &U[x * P * C], &U[(x + 1) * P * C]);
+
+	coeffs.resize(numX * C * P);
+
+	for (long x = 0; x < numX; x++)
+		for (long v = 0; v < P; v++)
+			for (long c = 0; c < C; c++)
+				coeffs[x + numX * (c + C * v)] = Conj(U[(x * P + v) * C + c]);
+
+	// whitening before compression: coeffs <- coeffs W, per readout position
+	if (NULL != whitening) {
+
+		std::vector<_Complex float> tmp(coeffs);
+
+		for (long x = 0; x < numX; x++)
+			for (long v = 0; v < P; v++)
+				for (long c = 0; c < C; c++) {
+
+					_Complex float sum = 0.;
+
+					for (long k = 0; k < C; k++)
+						sum += tmp[x + numX * (k + C * v)] * whitening[k + C * c];
+
+					coeffs[x + numX * (c + C * v)] = sum;
+				}
+	}
+
+	debug_printf(DP_DEBUG1, "Coil compression: %ld channels to %ld virtual coils (%s)\n", C, P, (Geometric == type) ? "geometric" : "svd");
+}
+
+
+BartIO::CoilCompression::CoilCompression(const long numChannels, const _Complex float* mat)
+	: numChannels(numChannels), numVirtual(numChannels), numX(1), coeffs(numChannels * numChannels)
+{
+	const long C = numChannels;
+
+	for (long v = 0; v < C; v++)
+		for (long c = 0; c < C; c++)
+			coeffs[c + C * v] = mat[v + C * c];
+}
+
+
+void BartIO::CoilCompression::Accumulate(const long channel, const long dims[2], const long ostrs[2], const long coilStride, _Complex float* out, const long istrs[2], const _Complex float* in) const
+{
+	assert((1 == numX) || (dims[0] == numX));
+
+	const long cstrs[2] = { (numX > 1) ? (long)CFL_SIZE : 0, 0 };
+
+	for (long v = 0; v < numVirtual; v++) {
+
+		_Complex float* dst = (_Complex float*)((char*)out + v * coilStride);
+
+		md_zfmac2(2, dims, ostrs, dst, istrs, in, cstrs, &coeffs[numX * (channel + numChannels * v)]);
+	}
+}
+
+
+void BartIO::CoilCompression::Apply(const long dims[PFILE_DIMS], const long ostrs[PFILE_DIMS], _Complex float* out, const long istrs[PFILE_DIMS], const _Complex float* in) const
+{
+	assert(dims[4] == numChannels);
+
+	long odims[PFILE_DIMS];
+	md_copy_dims(PFILE_DIMS, odims, dims);
+	odims[4] = numVirtual;
+
+	md_clear2(PFILE_DIMS, odims, ostrs, out, CFL_SIZE);
+
+	// positions [Phs2, TE, Phase] are independent
+	const long numPositions = dims[2] * dims[3] * dims[5];
+
+#pragma omp parallel for
+	for (long index = 0; index < numPositions; index++) {
+
+		long pos[PFILE_DIMS];
+		md_set_dims(PFILE_DIMS, pos, 0);
+
+		pos[2] = index % dims[2];
+		pos[3] = (index / dims[2]) % dims[3];
+		pos[5] = index / (dims[2] * dims[3]);
+
+		_Complex float* dst = (_Complex float*)((char*)out + md_calc_offset(PFILE_DIMS, ostrs, pos));
+
+		for (pos[4] = 0; pos[4] < numChannels; pos[4]++) {
+
+			const _Complex float* src = (const _Complex float*)((const char*)in + md_calc_offset(PFILE_DIMS, istrs, pos));
+
+			Accumulate(pos[4], dims, ostrs, ostrs[4], dst, istrs, src);
+		}
+	}
+}
+
+
+void BartIO::CoilCompression::Weights(_Complex float* vweights, const _Complex float* weights) const
+{
+	for (long v = 0; v < numVirtual; v++) {
+
+		float sum = 0.;
+
+		for (long c = 0; c < numChannels; c++) {
+
+			for (long x = 0; x < numX; x++) {
+
+				const _Complex float m = coeffs[x + numX * (c + numChannels * v)];
+
+				sum += (__real__ m * __real__ m + __imag__ m * __imag__ m) * __real__ weights[c];
+			}
+		}
+
+		vweights[v] = sum / numX;
+	}
+}
+
+
+void BartIO::CoilCompression::CalibrationDims(long caldims[PFILE_DIMS], const long dims[PFILE_DIMS], const Type type, const long calSize)
+{
+	md_singleton_dims(PFILE_DIMS, caldims);
+
+	for (int i = 0; i < 3; i++)
+		caldims[i] = std::min(calSize, dims[i]);
+
+	if (Geometric == type)
+		caldims[0] = dims[0];
+
+	caldims[4] = dims[4];
+}
+
+
+void BartIO::CoilCompression::Calibration(const long caldims[PFILE_DIMS], _Complex float* cal, const long dims[PFILE_DIMS], const _Complex float* ksp)
+{
+	long pos[PFILE_DIMS];
+	md_set_dims(PFILE_DIMS, pos, 0);
+
+	for (int i = 0; i < 3; i++)
+		pos[i] = dims[i] / 2 - caldims[i] / 2;
+
+	md_copy_block(PFILE_DIMS, pos, caldims, cal, dims, ksp, CFL_SIZE);
+}
@@ -0,0 +1,112 @@
+/* Copyright 2017. The Regents of the University of California.
+ * Copyright 2011-2017 General Electric Company. All rights reserved.
+ * GE Proprietary and Confidential Information. Only to be distributed with
+ * permission from GE. Resulting outputs are not for diagnostic purposes.
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+
+#include "BartIO.h"
+
+
+namespace GERecon
+{
+	namespace BartIO
+	{
+
+		/**
+		 * Coil compression learned from a calibration region, as bart cc.
+		 *
+		 * SVD compression uses one matrix for all samples. Geometric compression
+		 * uses one matrix per readout position, computed after an inverse FFT
+		 * along Read and aligned between neighbouring positions. Data is
+		 * compressed by accumulating each channel into the virtual coils, so
+		 * channels can be added in any order as they are read.
+		 */
+		class CoilCompression : private boost::noncopyable
+		{
+		public:
+
+			enum Type { SVD, Geometric };
+
+			/**
+			 * Type from its name: "svd" or "geometric"
+			 */
+			static Type TypeFromString(const std::string& name);
+
+			/**
+			 * @param caldims k-space calibration region: [Read, Phs1, Phs2, 1, Coil, 1]
+			 * @param cal calibration data
+			 * @param whitening if given, [Coil, Coil] whitening matrix applied to the channels before compression
+			 */
+			CoilCompression(const Type type, const long numVirtual, const long caldims[PFILE_DIMS], const _Complex float* cal, const _Complex float* whitening = NULL);
+
+			/**
+			 * Fixed mixing of the channels, virtual coil v = sum_c mat[v + C * c] channel c,
+			 * e.g. noise whitening.
+			 *
+			 * @param mat [Channel, Channel]
+			 */
+			CoilCompression(const long numChannels, const _Complex float* mat);
+
+			long ChannelCount() const { return numChannels; }
+
+			long VirtualCount() const { return numVirtual; }
+
+			/**
+			 * True if data has to be transformed along Read (fft -iu 1) before
+			 * compression and back (fft -u 1) after.
+			 */
+			bool Hybrid() const { return numX > 1; }
+
+			/**
+			 * Add channel to the virtual coils for a [Read, Phs1] block.
+			 *
+			 * @param ostrs output strides (bytes) for [Read, Phs1]
+			 * @param coilStride output stride (bytes) between virtual coils
+			 * @param out first virtual coil of the block
+			 */
+			void Accumulate(const long channel, const long dims[2], const long ostrs[2], const long coilStride, _Complex float* out, const long istrs[2], const _Complex float* in) const;
+
+			/**
+			 * Compress an array. The output has VirtualCount() coils.
+			 *
+			 * @param dims input dims: [Read, Phs1, Phs2, TE, Coil, Phase]
+			 * @param ostrs output strides (bytes) for the Pfile dimensions
+			 */
+			void Apply(const long dims[PFILE_DIMS], const long ostrs[PFILE_DIMS], _Complex float* out, const long istrs[PFILE_DIMS], const _Complex float* in) const;
+
+			/**
+			 * Channel weights of the virtual coils: each virtual coil gets the
+			 * channel weights averaged with its (squared) coefficients
+			 */
+			void Weights(_Complex float* vweights, const _Complex float* weights) const;
+
+			/**
+			 * Dims of the centered calibration region of a Pfile-ordered array.
+			 * Uses the first echo and phase, and the full readout for geometric
+			 * compression.
+			 */
+			static void CalibrationDims(long caldims[PFILE_DIMS], const long dims[PFILE_DIMS], const Type type, const long calSize);
+
+			/**
+			 * Copy the centered calibration region from a Pfile-ordered array
+			 */
+			static void Calibration(const long caldims[PFILE_DIMS], _Complex float* cal, const long dims[PFILE_DIMS], const _Complex float* ksp);
+
+		private:
+
+			const long numChannels;
+			const long numVirtual;
+			const long numX;
+
+			// conjugated compression matrices: [X, Coil, Virtual coil]
+			std::vector<_Complex float> coeffs;
+		};
+	}
+}
@@ -0,0 +1,590 @@
+/* Copyright 2017. The Regents of the University of California.
+ * Copyright 2011-2017 General Electric Company. All rights reserved.
+ * GE Proprietary and Confidential Information. Only to be distributed with
+ * permission from GE. Resulting outputs are not for diagnostic purposes.
+ */
+
+#include <algorithm>
+#include <fstream>
+#include <random>
+#include <set>
+#include <sstream>
+#include <utility>
+
+#include <stdlib.h>
+#include <string.h>
+
+// includes for bart
+#include "misc/misc.h"
+#include "misc/debug.h"
+
+#include "DicomMultiFrame.h"
+
+
+using namespace GERecon;
+
+
+static const char* const EnhancedMRImageStorage = "1.2.840.10008.5.1.4.1.1.4.1";
+static const char* const ExplicitVRLittleEndian = "1.2.840.10008.1.2.1";
+static const char* const ImplicitVRLittleEndian = "1.2.840.10008.1.2";
+
+static const uint32_t UndefinedLength = 0xFFFFFFFF;
+
+static const uint32_t ItemTag = 0xFFFEE000;
+static const uint32_t ItemDelimitationTag = 0xFFFEE00D;
+static const uint32_t SequenceDelimitationTag = 0xFFFEE0DD;
+
+static const uint32_t TransferSyntaxTag = 0x00020010;
+static const uint32_t ImageTypeTag = 0x00080008;
+static const uint32_t SOPClassTag = 0x00080016;
+static const uint32_t SOPInstanceTag = 0x00080018;
+static const uint32_t EchoTimeTag = 0x00180081;
+static const uint32_t SliceThicknessTag = 0x00180050;
+static const uint32_t InstanceNumberTag = 0x00200013;
+static const uint32_t ImagePositionTag = 0x00200032;
+static const uint32_t ImageOrientationTag = 0x00200037;
+static const uint32_t SliceLocationTag = 0x00201041;
+static const uint32_t NumberOfFramesTag = 0x00280008;
+static const uint32_t PixelSpacingTag = 0x00280030;
+static const uint32_t PixelDataTag = 0x7FE00010;
+
+static const uint32_t MREchoTag = 0x00189114;
+static const uint32_t EffectiveEchoTimeTag = 0x00189082;
+static const uint32_t StackIDTag = 0x00209056;
+static const uint32_t InStackPositionTag = 0x00209057;
+static const uint32_t FrameContentTag = 0x00209111;
+static const uint32_t TemporalPositionTag = 0x00209128;
+static const uint32_t DimensionIndexValuesTag = 0x00209157;
+static const uint32_t DimensionOrganizationUIDTag = 0x00209164;
+
+
+static uint16_t Read16(const std::string& buf, const size_t pos)
+{
+	if (pos + 2 > buf.size())
+		error("Truncated Dicom file!\n");
+
+	return (uint8_t)buf[pos] | ((uint8_t)buf[pos + 1] << 8);
+}
+
+
+static uint32_t Read32(const std::string& buf, const size_t pos)
+{
+	return Read16(buf, pos) | ((uint32_t)Read16(buf, pos + 2) << 16);
+}
+
+
+static std::string Write16(const uint16_t v)
+{
+	const char b[2] = { (char)(v & 0xFF), (char)(v >> 8) };
+	return std::string(b, 2);
+}
+
+
+static std::string Write32(const uint32_t v)
+{
+	return Write16(v & 0xFFFF) + Write16(v >> 16);
+}
+
+
+/*
+ * VRs with a 32 bit length in explicit VR encoding
+ */
+static bool LongVR(const std::string& vr)
+{
+	static const char* const vrs[] = { "OB", "OD", "OF", "OL", "OW", "SQ", "UC", "UN", "UR", "UT" };
+
+	for (size_t i = 0; i < sizeof(vrs) / sizeof(vrs[0]); i++)
+		if (vr == vrs[i])
+			return true;
+
+	return false;
+}
+
+
+static std::string Trim(const std::string& value)
+{
+	const size_t end = value.find_last_not_of(std::string(" \0", 2));
+
+	return (std::string::npos == end) ? std::string() : value.substr(0, end + 1);
+}
+
+
+static size_t SkipSequence(const std::string& buf, size_t pos, const bool explicitVR);
+
+
+/*
+ * Parse elements from pos up to the end of the buffer, or up to the item
+ * delimitation of an item of undefined length. Returns the position after
+ * the last element.
+ */
+static size_t ParseElements(const std::string& buf, size_t pos, const bool explicitVR, const bool item, BartIO::MultiFrameDicom::DataSet* out, const bool metaOnly = false)
+{
+	while (pos < buf.size()) {
+
+		const uint16_t group = Read16(buf, pos);
+		const uint32_t tag = ((uint32_t)group << 16) | Read16(buf, pos + 2);
+
+		if (metaOnly && (0x0002 != group))
+			return pos;
+
+		if (ItemDelimitationTag == tag) {
+
+			if (!item)
+				error("Unexpected item delimitation in Dicom file!\n");
+
+			return pos + 8;
+		}
+
+		uint32_t len;
+		size_t hdr;
+
+		if (explicitVR && (0xFFFE != group)) {
+
+			if (pos + 6 > buf.size())
+				error("Truncated Dicom file!\n");
+
+			const std::string vr = buf.substr(pos + 4, 2);
+
+			if (LongVR(vr)) {
+
+				len = Read32(buf, pos + 8);
+				hdr = 12;
+
+			} else {
+
+				len = Read16(buf, pos + 6);
+				hdr = 8;
+			}
+
+		} else {
+
+			len = Read32(buf, pos + 4);
+			hdr = 8;
+		}
+
+		size_t end;
+
+		if (UndefinedLength == len) {
+
+			if (PixelDataTag == tag)
+				error("Encapsulated pixel data is not supported!\n");
+
+			end = SkipSequence(buf, pos + hdr, explicitVR);
+
+		} else {
+
+			end = pos + hdr + len;
+
+			if (end > buf.size())
+				error("Truncated Dicom file!\n");
+		}
+
+		if (NULL != out) {
+
+			BartIO::MultiFrameDicom::Element element;
+
+			element.tag = tag;
+			element.raw = buf.substr(pos, end - pos);
+
+			if (UndefinedLength != len)
+				element.value = buf.substr(pos + hdr, len);
+
+			(*out)[tag] = element;
+		}
+
+		pos = end;
+	}
+
+	if (item)
+		error("Missing item delimitation in Dicom file!\n");
+
+	return pos;
+}
+
+
+/*
+ * Skip the items of a sequence of undefined length
+ */
+static size_t SkipSequence(const std::string& buf, size_t pos, const bool explicitVR)
+{
+	while (true) {
+
+		const uint32_t tag = ((uint32_t)Read16(buf, pos) << 16) | Read16(buf, pos + 2);
+		const uint32_t len = Read32(buf, pos + 4);
+
+		if (SequenceDelimitationTag == tag)
+			return pos + 8;
+
+		if (ItemTag != tag)
+			error("Invalid sequence item in Dicom file!\n");
+
+		if (UndefinedLength == len)
+			pos = ParseElements(buf, pos + 8, explicitVR, true, NULL);
+		else
+			pos += 8 + len;
+	}
+}
+
+
+static std::string Encode(const uint32_t tag, const std::string& vr, std::string value, const bool explicitVR)
+{
+	// string values are padded with spaces, UIDs and binary values with zeros
+	if (0 != value.size() % 2)
+		value += ((vr == "UI") || (vr == "OB")) ? '\0' : ' ';
+
+	std::string out = Write16(tag >> 16) + Write16(tag & 0xFFFF);
+
+	if (explicitVR) {
+
+		out += vr;
+		out += LongVR(vr) ? (Write16(0) + Write32(value.size())) : Write16(value.size());
+
+	} else {
+
+		out += Write32(value.size());
+	}
+
+	return out + value;
+}
+
+
+/*
+ * Sequence of defined length. Items are encoded elements in ascending order
+ */
+static std::string EncodeSequence(const uint32_t tag, const std::vector<std::string>& items, const bool explicitVR)
+{
+	std::string content;
+
+	for (size_t i = 0; i < items.size(); i++)
+		content += Write16(0xFFFE) + Write16(0xE000) + Write32(items[i].size()) + items[i];
+
+	return Encode(tag, "SQ", content, explicitVR);
+}
+
+
+static std::string EncodeSequence(const uint32_t tag, const std::string& item, const bool explicitVR)
+{
+	return EncodeSequence(tag, std::vector<std::string>(1, item), explicitVR);
+}
+
+
+static std::string EncodeTag(const uint32_t tag)
+{
+	return Write16(tag >> 16) + Write16(tag & 0xFFFF);
+}
+
+
+/*
+ * UID from a random UUID, as 2.25.<decimal value of the UUID>
+ */
+static std::string NewUID()
+{
+	std::random_device random;
+
+	unsigned __int128 uuid = 0;
+
+	for (int i = 0; i < 4; i++)
+		uuid = (uuid << 32) | (uint32_t)random();
+
+	std::string digits;
+
+	do {
+		digits += (char)('0' + (int)(uuid % 10));
+		uuid /= 10;
+
+	} while (0 != uuid);
+
+	return "2.25." + std::string(digits.rbegin(), digits.rend());
+}
+
+
+/*
+ * Attributes of the MR image description macros, shared by the image and
+ * the frames: reconstructed magnitude volumes
+ */
+static std::string EncodeImageDescription(const bool explicitVR)
+{
+	return Encode(0x00089205, "CS", "MONOCHROME", explicitVR)
+	     + Encode(0x00089206, "CS", "VOLUME", explicitVR)
+	     + Encode(0x00089207, "CS", "NONE", explicitVR)
+	     + Encode(0x00089208, "CS", "MAGNITUDE", explicitVR)
+	     + Encode(0x00089209, "CS", "UNKNOWN", explicitVR);
+}
+
+
+/*
+ * Four-valued Image Type of Enhanced MR. Value 1 and 2 come from the frames.
+ */
+static std::string ImageType(const std::string& frameImageType)
+{
+	std::vector<std::string> values;
+	std::istringstream in(Trim(frameImageType));
+	std::string value;
+
+	while ((values.size() < 2) && std::getline(in, value, '\\'))
+		values.push_back(value);
+
+	if (2 != values.size()) {
+
+		values.clear();
+		values.push_back("ORIGINAL");
+		values.push_back("PRIMARY");
+	}
+
+	// image flavor and derived pixel contrast
+	return values[0] + "\\" + values[1] + "\\VOLUME\\" + (("ORIGINAL" == values[0]) ? "NONE" : "MAGNITUDE");
+}
+
+
+BartIO::MultiFrameDicom::MultiFrameDicom()
+	: explicitVR(true), frameBytes(0)
+{
+}
+
+
+long BartIO::MultiFrameDicom::Add(const std::string& buf, const int stackPosition, const int temporalPosition, const int echoPosition)
+{
+	if ((buf.size() < 132) || (0 != buf.compare(128, 4, "DICM")))
+		error("Frame is not a Dicom Part 10 object!\n");
+
+	// the file meta information is always explicit VR little endian
+	DataSet frameMeta;
+	const size_t start = ParseElements(buf, 132, true, false, &frameMeta, true);
+
+	const std::string transferSyntax = Trim(frameMeta[TransferSyntaxTag].value);
+
+	bool frameExplicitVR = true;
+
+	if (transferSyntax == ImplicitVRLittleEndian)
+		frameExplicitVR = false;
+	else if (transferSyntax != ExplicitVRLittleEndian)
+		error("Unsupported transfer syntax %s!\n", transferSyntax.c_str());
+
+	DataSet frame;
+	ParseElements(buf, start, frameExplicitVR, false, &frame);
+
+	if (0 == frame.count(PixelDataTag))
+		error("No pixel data in frame!\n");
+
+	// per-frame functional groups in ascending order: MR echo, frame content,
+	// plane position and plane orientation. The frame content, with the
+	// dimension index values, is encoded in Save()
+	Frame item;
+
+	item.stackPosition = stackPosition;
+	item.temporalPosition = temporalPosition;
+	item.echoPosition = echoPosition;
+
+	if (0 != frame.count(EchoTimeTag)) {
+
+		const double echoTime = strtod(Trim(frame[EchoTimeTag].value).c_str(), NULL);
+
+		std::string fd(sizeof(double), '\0');
+		memcpy(&fd[0], &echoTime, sizeof(double));
+
+		item.echo = EncodeSequence(MREchoTag, Encode(EffectiveEchoTimeTag, "FD", fd, frameExplicitVR), frameExplicitVR);
+	}
+
+	if (0 != frame.count(ImagePositionTag))
+		item.geometry += EncodeSequence(0x00209113, frame[ImagePositionTag].raw, frameExplicitVR);
+
+	if (0 != frame.count(ImageOrientationTag))
+		item.geometry += EncodeSequence(0x00209116, frame[ImageOrientationTag].raw, frameExplicitVR);
+
+	item.pixels.swap(frame[PixelDataTag].value);
+
+	std::lock_guard<std::mutex> lock(mutex);
+
+	if (frames.empty()) {
+
+		explicitVR = frameExplicitVR;
+		meta = frameMeta;
+		shared = frame;
+		shared.erase(shared.lower_bound(PixelDataTag), shared.end());
+		frameBytes = item.pixels.size();
+
+	} else if ((frameExplicitVR != explicitVR) || (item.pixels.size() != frameBytes)) {
+
+		error("Frame at position %d, %d, %d does not match the previous frames!\n", stackPosition, temporalPosition, echoPosition);
+	}
+
+	frames.push_back(std::move(item));
+
+	return frames.size();
+}
+
+
+long BartIO::MultiFrameDicom::FrameCount() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	return frames.size();
+}
+
+
+void BartIO::MultiFrameDicom::Save(const std::string& path, const int instance)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	if (frames.empty())
+		error("No frames for %s!\n", path.c_str());
+
+	const uint64_t pixelBytes = (uint64_t)frameBytes * frames.size();
+
+	if (pixelBytes >= UndefinedLength)
+		error("Too many frames for %s!\n", path.c_str());
+
+	// frames arrive in the order the writers finish them
+	std::sort(frames.begin(), frames.end(), [](const Frame& a, const Frame& b) {
+
+		if (a.stackPosition != b.stackPosition)
+			return a.stackPosition < b.stackPosition;
+
+		if (a.temporalPosition != b.temporalPosition)
+			return a.temporalPosition < b.temporalPosition;
+
+		return a.echoPosition < b.echoPosition;
+	});
+
+	// the first frame is not written on its own, so its UID is reused
+	const std::string sopInstance = Trim(shared[SOPInstanceTag].value);
+
+	DataSet dataSet = shared;
+
+	const uint32_t moved[] = { EchoTimeTag, SliceThicknessTag, ImagePositionTag, ImageOrientationTag, SliceLocationTag, PixelSpacingTag };
+
+	for (size_t i = 0; i < sizeof(moved) / sizeof(moved[0]); i++)
+		dataSet.erase(moved[i]);
+
+	auto put = [](DataSet& ds, const uint32_t tag, const std::string& raw) {
+
+		Element element;
+		element.tag = tag;
+		element.raw = raw;
+
+		ds[tag] = element;
+	};
+
+	put(dataSet, SOPClassTag, Encode(SOPClassTag, "UI", EnhancedMRImageStorage, explicitVR));
+	put(dataSet, SOPInstanceTag, Encode(SOPInstanceTag, "UI", sopInstance, explicitVR));
+	put(dataSet, InstanceNumberTag, Encode(InstanceNumberTag, "IS", std::to_string(instance), explicitVR));
+	put(dataSet, NumberOfFramesTag, Encode(NumberOfFramesTag, "IS", std::to_string(frames.size()), explicitVR));
+
+	// enhanced MR image: image type and image description
+	const std::string imageType = ImageType(shared[ImageTypeTag].value);
+
+	put(dataSet, ImageTypeTag, Encode(ImageTypeTag, "CS", imageType, explicitVR));
+
+	std::string description = EncodeImageDescription(explicitVR);
+
+	ParseElements(description, 0, explicitVR, false, &dataSet);
+
+	// multi-frame dimensions: stack, in-stack position, temporal position and
+	// echo time, the last only with several echoes
+	std::set<int> echoes;
+
+	for (size_t i = 0; i < frames.size(); i++)
+		echoes.insert(frames[i].echoPosition);
+
+	const bool echoDimension = (echoes.size() > 1);
+
+	const std::string organization = Encode(DimensionOrganizationUIDTag, "UI", NewUID(), explicitVR);
+
+	const uint32_t pointers[][2] = {
+		{ StackIDTag, FrameContentTag },
+		{ InStackPositionTag, FrameContentTag },
+		{ TemporalPositionTag, FrameContentTag },
+		{ EffectiveEchoTimeTag, MREchoTag },
+	};
+
+	std::vector<std::string> dimensions;
+
+	for (int i = 0; i < (echoDimension ? 4 : 3); i++)
+		dimensions.push_back(organization
+				   + Encode(0x00209165, "AT", EncodeTag(pointers[i][0]), explicitVR)
+				   + Encode(0x00209167, "AT", EncodeTag(pointers[i][1]), explicitVR));
+
+	put(dataSet, 0x00209221, EncodeSequence(0x00209221, organization, explicitVR));
+	put(dataSet, 0x00209222, EncodeSequence(0x00209222, dimensions, explicitVR));
+
+	// shared functional groups: MR image frame type and pixel measures
+	std::string measures;
+
+	if (0 != shared.count(SliceThicknessTag))
+		measures += shared[SliceThicknessTag].raw;
+
+	if (0 != shared.count(PixelSpacingTag))
+		measures += shared[PixelSpacingTag].raw;
+
+	const std::string frameType = Encode(0x00089007, "CS", imageType, explicitVR) + description;
+
+	const std::string sharedGroups = EncodeSequence(0x00189226, frameType, explicitVR)
+				       + EncodeSequence(0x00289110, measures, explicitVR);
+
+	put(dataSet, 0x52009229, EncodeSequence(0x52009229, sharedGroups, explicitVR));
+
+	// per-frame functional groups, with the index of each dimension. The
+	// positions are 1-based and consecutive, so they are their own index
+	std::vector<std::string> frameItems;
+
+	for (size_t i = 0; i < frames.size(); i++) {
+
+		const Frame& frame = frames[i];
+
+		if (echoDimension && frame.echo.empty())
+			error("No echo time for frame %ld of %s!\n", (long)i + 1, path.c_str());
+
+		std::string index = Write32(1) + Write32(frame.stackPosition) + Write32(frame.temporalPosition);
+
+		if (echoDimension)
+			index += Write32(std::distance(echoes.begin(), echoes.find(frame.echoPosition)) + 1);
+
+		const std::string frameContent = Encode(StackIDTag, "SH", "1", explicitVR)
+					       + Encode(InStackPositionTag, "UL", Write32(frame.stackPosition), explicitVR)
+					       + Encode(TemporalPositionTag, "UL", Write32(frame.temporalPosition), explicitVR)
+					       + Encode(DimensionIndexValuesTag, "UL", index, explicitVR);
+
+		frameItems.push_back(frame.echo + EncodeSequence(FrameContentTag, frameContent, explicitVR) + frame.geometry);
+	}
+
+	put(dataSet, 0x52009230, EncodeSequence(0x52009230, frameItems, explicitVR));
+
+	DataSet fileMeta = meta;
+	fileMeta.erase(0x00020000);
+
+	put(fileMeta, 0x00020002, Encode(0x00020002, "UI", EnhancedMRImageStorage, true));
+	put(fileMeta, 0x00020003, Encode(0x00020003, "UI", sopInstance, true));
+
+	uint32_t metaBytes = 0;
+
+	for (DataSet::const_iterator it = fileMeta.begin(); it != fileMeta.end(); ++it)
+		metaBytes += it->second.raw.size();
+
+	put(fileMeta, 0x00020000, Encode(0x00020000, "UL", Write32(metaBytes), true));
+
+	std::ofstream out(path.c_str(), std::ios::binary);
+
+	out << std::string(128, '\0') << "DICM";
+
+	for (DataSet::const_iterator it = fileMeta.begin(); it != fileMeta.end(); ++it)
+		out << it->second.raw;
+
+	for (DataSet::const_iterator it = dataSet.begin(); it != dataSet.end(); ++it)
+		out << it->second.raw;
+
+	// pixel data of all frames
+	out << Write16(PixelDataTag >> 16) << Write16(PixelDataTag & 0xFFFF);
+
+	if (explicitVR)
+		out << "OW" << Write16(0);
+
+	out << Write32(pixelBytes);
+
+	for (size_t i = 0; i < frames.size(); i++)
+		out << frames[i].pixels;
+
+	if (!out)
+		error("Could not write %s!\n", path.c_str());
+
+	debug_printf(DP_DEBUG1, "Wrote %ld frames to %s\n", (long)frames.size(), path.c_str());
+}
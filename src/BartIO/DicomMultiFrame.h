@@ -0,0 +1,101 @@
+/* Copyright 2017. The Regents of the University of California.
+ * Copyright 2011-2017 General Electric Company. All rights reserved.
+ * GE Proprietary and Confidential Information. Only to be distributed with
+ * permission from GE. Resulting outputs are not for diagnostic purposes.
+ */
+
+#pragma once
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+
+#include <boost/noncopyable.hpp>
+
+
+namespace GERecon
+{
+	namespace BartIO
+	{
+
+		/**
+		 * Enhanced MR multi-frame Dicom object packed from single-frame images.
+		 *
+		 * Frames are added as single-frame Part 10 data, as written by
+		 * GEDicom::MR::Image::Save(). Attributes shared by all frames are taken
+		 * from the first frame. Image position, orientation and echo time move
+		 * to the per-frame functional groups, pixel spacing and slice thickness
+		 * to the shared functional groups. The object is a single stack with
+		 * the dimensions in-stack position, temporal position and, with several
+		 * echoes, echo time, and magnitude frames of type VOLUME. The output
+		 * keeps the transfer syntax of the frames, which must be uncompressed
+		 * little endian. Pixel data is kept in memory until Save(), which
+		 * writes the frames ordered by stack, temporal and echo position.
+		 */
+		class MultiFrameDicom : private boost::noncopyable
+		{
+		public:
+
+			MultiFrameDicom();
+
+			/**
+			 * Add a single-frame Part 10 object. Thread safe.
+			 *
+			 * @param stackPosition position of the frame in its stack (1-based)
+			 * @param temporalPosition temporal position of the frame (1-based)
+			 * @param echoPosition echo of the frame (1-based)
+			 * @return number of frames including this one
+			 */
+			long Add(const std::string& part10, const int stackPosition, const int temporalPosition, const int echoPosition = 1);
+
+			long FrameCount() const;
+
+			/**
+			 * Write the multi-frame object
+			 *
+			 * @param instance instance number of the object within the series
+			 */
+			void Save(const std::string& path, const int instance);
+
+			struct Element
+			{
+				uint32_t tag;
+
+				// complete encoding and value of the element
+				std::string raw;
+				std::string value;
+			};
+
+			typedef std::map<uint32_t, Element> DataSet;
+
+		private:
+
+			mutable std::mutex mutex;
+
+			bool explicitVR;
+
+			DataSet meta;
+			DataSet shared;
+
+			struct Frame
+			{
+				// encoded per-frame functional groups before and after the frame content
+				std::string echo;
+				std::string geometry;
+
+				int stackPosition;
+				int temporalPosition;
+				int echoPosition;
+
+				std::string pixels;
+			};
+
+			std::vector<Frame> frames;
+
+			size_t frameBytes;
+		};
+	}
+}
@@ -0,0 +1,247 @@
+/* Copyright 2017. The Regents of the University of California.
+ * Copyright 2011-2017 General Electric Company. All rights reserved.
+ * GE Proprietary and Confidential Information. Only to be distributed with
+ * permission from GE. Resulting outputs are not for diagnostic purposes.
+ */
+
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+
+#include <stdio.h>
+#include <unistd.h>
+
+#include <boost/filesystem.hpp>
+
+// includes for bart
+#include "misc/misc.h"
+#include "misc/debug.h"
+
+#include "DicomWriter.h"
+
+
+using namespace GERecon;
+
+
+BartIO::DicomWriter::DicomWriter(const GEDicom::NetworkPointer& dicomNetwork, const Grouping grouping, const std::string& fileNamePrefix,
+		const int numSlices, const int numEchoes, const int numPhases, const int numWriters, const size_t capacity)
+	: dicomNetwork(dicomNetwork), saveQueue(capacity), sendQueue(capacity), grouping(grouping), fileNamePrefix(fileNamePrefix), numEchoes(numEchoes),
+	  framesPerObject((Series == grouping) ? (long)numSlices * numEchoes * numPhases : numSlices)
+{
+	if (dicomNetwork && (SingleFrame != grouping))
+		error("Multi-frame objects cannot be stored to the network!\n");
+
+	for (int i = 0; i < std::max(1, numWriters); i++)
+		writers.push_back(std::thread(&DicomWriter::Write, this, i));
+
+	if (dicomNetwork)
+		sender = std::thread(&DicomWriter::Send, this);
+}
+
+
+BartIO::DicomWriter::~DicomWriter()
+{
+	try {
+
+		Finish();
+
+	} catch (...) {
+
+		// errors are reported by an explicit Finish()
+	}
+}
+
+
+BartIO::DicomWriter::Grouping BartIO::DicomWriter::GroupingFromString(const std::string& grouping)
+{
+	if (grouping == "none")
+		return SingleFrame;
+
+	if (grouping == "series")
+		return Series;
+
+	if (grouping == "volume")
+		return Volume;
+
+	error("Unknown multi-frame grouping %s!\n", grouping.c_str());
+	return SingleFrame;
+}
+
+
+void BartIO::DicomWriter::Submit(const GEDicom::MR::ImagePointer& dicom, const std::string& path, const int slice, const int echo, const int phase)
+{
+	Item item;
+
+	item.dicom = dicom;
+	item.path = path;
+	item.slice = slice;
+	item.echo = echo;
+	item.phase = phase;
+
+	// fails only after an error, which Finish() reports
+	saveQueue.Push(item);
+}
+
+
+/*
+ * Scratch file a writer saves frames to before packing them. On a tmpfs
+ * when there is one, so frames only pass through memory
+ */
+std::string BartIO::DicomWriter::FramePath(const int writer) const
+{
+	boost::system::error_code ec;
+
+	if (boost::filesystem::is_directory("/dev/shm", ec))
+		return "/dev/shm/BartIOFrame" + std::to_string(getpid()) + "-" + std::to_string(writer) + ".dcm";
+
+	return fileNamePrefix + "Frame" + std::to_string(writer) + ".tmp";
+}
+
+
+std::string BartIO::DicomWriter::MultiFramePath(const int group) const
+{
+	return fileNamePrefix + "MultiFrame" + std::to_string(group + 1) + ".dcm";
+}
+
+
+void BartIO::DicomWriter::Finish()
+{
+	saveQueue.Close();
+
+	for (size_t i = 0; i < writers.size(); i++)
+		writers[i].join();
+
+	writers.clear();
+
+	sendQueue.Close();
+
+	if (sender.joinable())
+		sender.join();
+
+	// objects that did not receive all frames, e.g. after an error
+	for (std::map<int, boost::shared_ptr<MultiFrameDicom> >::const_iterator it = objects.begin(); it != objects.end(); ++it) {
+
+		debug_printf(DP_WARN, "Writing incomplete multi-frame object %s.\n", MultiFramePath(it->first).c_str());
+		it->second->Save(MultiFramePath(it->first), it->first + 1);
+	}
+
+	objects.clear();
+
+	std::lock_guard<std::mutex> lock(errorMutex);
+
+	if (failure) {
+
+		std::exception_ptr e = failure;
+		failure = std::exception_ptr();
+
+		std::rethrow_exception(e);
+	}
+}
+
+
+void BartIO::DicomWriter::Write(const int writer)
+{
+	// frames to be packed pass through one scratch file per writer
+	const std::string framePath = FramePath(writer);
+
+	Item item;
+
+	try {
+
+		while (saveQueue.Pop(item)) {
+
+			if (SingleFrame != grouping) {
+
+				Pack(item, framePath);
+				continue;
+			}
+
+			item.dicom->Save(item.path);
+
+			if (dicomNetwork)
+				sendQueue.Push(item.dicom);
+		}
+
+	} catch (...) {
+
+		Fail();
+	}
+
+	if (SingleFrame != grouping)
+		remove(framePath.c_str());
+}
+
+
+/*
+ * Add an image to its multi-frame object and write the object once complete
+ */
+void BartIO::DicomWriter::Pack(const Item& item, const std::string& framePath)
+{
+	const int group = (Series == grouping) ? 0 : item.phase * numEchoes + item.echo;
+
+	boost::shared_ptr<MultiFrameDicom> object;
+
+	{
+		std::lock_guard<std::mutex> lock(objectsMutex);
+
+		boost::shared_ptr<MultiFrameDicom>& slot = objects[group];
+
+		if (!slot)
+			slot.reset(new MultiFrameDicom());
+
+		object = slot;
+	}
+
+	// the SDK only saves to a path, so the frame is read back once
+	item.dicom->Save(framePath);
+
+	std::ifstream in(framePath.c_str(), std::ios::binary);
+
+	if (!in)
+		error("Could not read %s!\n", framePath.c_str());
+
+	const std::string part10((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+
+	if (object->Add(part10, item.slice + 1, item.phase + 1, item.echo + 1) < framesPerObject)
+		return;
+
+	{
+		std::lock_guard<std::mutex> lock(objectsMutex);
+		objects.erase(group);
+	}
+
+	object->Save(MultiFramePath(group), group + 1);
+}
+
+
+void BartIO::DicomWriter::Send()
+{
+	GEDicom::MR::ImagePointer dicom;
+
+	try {
+
+		while (sendQueue.Pop(dicom))
+			dicom->Store(dicomNetwork);
+
+	} catch (...) {
+
+		Fail();
+	}
+}
+
+
+/*
+ * Keep the first error and stop accepting images
+ */
+void BartIO::DicomWriter::Fail()
+{
+	{
+		std::lock_guard<std::mutex> lock(errorMutex);
+
+		if (!failure)
+			failure = std::current_exception();
+	}
+
+	saveQueue.Close();
+	sendQueue.Close();
+}
@@ -0,0 +1,121 @@
+/* Copyright 2017. The Regents of the University of California.
+ * Copyright 2011-2017 General Electric Company. All rights reserved.
+ * GE Proprietary and Confidential Information. Only to be distributed with
+ * permission from GE. Resulting outputs are not for diagnostic purposes.
+ */
+
+#pragma once
+
+#include <exception>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include <Dicom/Core/MR/Image.h>
+#include <Dicom/Core/Network.h>
+
+#include "BoundedQueue.h"
+#include "DicomMultiFrame.h"
+
+
+namespace GERecon
+{
+	namespace BartIO
+	{
+
+		/**
+		 * Saves and sends Dicom images in the background.
+		 *
+		 * Compute threads Submit() finished images to a bounded queue. A pool
+		 * of writers saves them to file and hands them to a single sender,
+		 * which stores them one after another over the network, so only one
+		 * association is in use. Finish() waits for all images and rethrows
+		 * the first error of the background threads.
+		 *
+		 * With a grouping other than SingleFrame, images are instead packed
+		 * into multi-frame objects <prefix>MultiFrame<n>.dcm, one per series
+		 * or one per echo and phase. Multi-frame objects cannot be stored to
+		 * the network, so a grouping together with a network is an error.
+		 */
+		class DicomWriter : private boost::noncopyable
+		{
+		public:
+
+			enum Grouping { SingleFrame, Series, Volume };
+
+			/**
+			 * none, series or volume
+			 */
+			static Grouping GroupingFromString(const std::string& grouping);
+
+			/**
+			 * @param dicomNetwork network to store images to, or NULL
+			 * @param grouping multi-frame grouping of the images
+			 * @param fileNamePrefix prefix of the multi-frame objects
+			 * @param numWriters number of threads saving files
+			 * @param capacity number of images waiting to be saved before Submit() blocks
+			 */
+			DicomWriter(const GEDicom::NetworkPointer& dicomNetwork, const Grouping grouping = SingleFrame, const std::string& fileNamePrefix = std::string(),
+					const int numSlices = 1, const int numEchoes = 1, const int numPhases = 1, const int numWriters = 2, const size_t capacity = 64);
+
+			~DicomWriter();
+
+			/**
+			 * Queue an image to be saved to path (and stored)
+			 */
+			void Submit(const GEDicom::MR::ImagePointer& dicom, const std::string& path, const int slice = 0, const int echo = 0, const int phase = 0);
+
+			void Finish();
+
+		private:
+
+			struct Item
+			{
+				GEDicom::MR::ImagePointer dicom;
+				std::string path;
+
+				int slice;
+				int echo;
+				int phase;
+			};
+
+			void Write(const int writer);
+
+			void Pack(const Item& item, const std::string& framePath);
+
+			std::string FramePath(const int writer) const;
+
+			std::string MultiFramePath(const int group) const;
+
+			void Send();
+
+			void Fail();
+
+			const GEDicom::NetworkPointer dicomNetwork;
+
+			BoundedQueue<Item> saveQueue;
+			BoundedQueue<GEDicom::MR::ImagePointer> sendQueue;
+
+			std::vector<std::thread> writers;
+			std::thread sender;
+
+			// set before the threads start
+			const Grouping grouping;
+			const std::string fileNamePrefix;
+			const int numEchoes;
+			const long framesPerObject;
+
+			std::mutex objectsMutex;
+			std::map<int, boost::shared_ptr<MultiFrameDicom> > objects;
+
+			std::mutex errorMutex;
+			std::exception_ptr failure;
+		};
+	}
+}
@@ -0,0 +1,100 @@
+/* Copyright 2018. The Regents of the University of California.
+ * Copyright 2011-2018 General Electric Company. All rights reserved.
+ * GE Proprietary and Confidential Information. Only to be distributed with
+ * permission from GE. Resulting outputs are not for diagnostic purposes.
+ */
+
+#include <list>
+#include <map>
+#include <mutex>
+#include <string>
+
+#include <Orchestra/Legacy/Pfile.h>
+#include <Orchestra/Cartesian2D/LxControlSource.h>
+#include <Orchestra/Control/ProcessingControl.h>
+
+// includes for bart
+#include "misc/misc.h"
+#include "misc/debug.h"
+
+#include "ExamCache.h"
+
+
+using namespace GERecon;
+
+
+static std::mutex examMutex;
+static std::map<std::string, Legacy::PfilePointer> pfiles;
+static std::map<std::pair<std::string, bool>, Control::ProcessingControlPointer> controls;
+
+// most recently used first
+static std::list<std::string> examOrder;
+
+
+/*
+ * Same key for every spelling of the path
+ */
+static std::string ExamKey(const boost::filesystem::path& pfilePath)
+{
+	return boost::filesystem::canonical(pfilePath).string();
+}
+
+
+Legacy::PfilePointer BartIO::OpenPfile(const boost::filesystem::path& pfilePath)
+{
+	const std::string key = ExamKey(pfilePath);
+
+	std::lock_guard<std::mutex> lock(examMutex);
+
+	examOrder.remove(key);
+	examOrder.push_front(key);
+
+	Legacy::PfilePointer& pfile = pfiles[key];
+
+	if (!pfile) {
+
+		debug_printf(DP_DEBUG1, "Opening Pfile %s\n", key.c_str());
+
+		pfile = Legacy::Pfile::Create(pfilePath, Legacy::Pfile::AllAvailableAcquisitions, AnonymizationPolicy(AnonymizationPolicy::None));
+	}
+
+	return pfile;
+}
+
+
+Control::ProcessingControlPointer BartIO::PfileProcessingControl(const boost::filesystem::path& pfilePath, const bool lxControl)
+{
+	const Legacy::PfilePointer pfile = OpenPfile(pfilePath);
+
+	std::lock_guard<std::mutex> lock(examMutex);
+
+	Control::ProcessingControlPointer& processingControl = controls[std::make_pair(ExamKey(pfilePath), lxControl)];
+
+	if (!processingControl) {
+
+		if (lxControl)
+			processingControl = pfile->CreateOrchestraProcessingControl<Cartesian2D::LxControlSource>();
+		else
+			processingControl = pfile->CreateOrchestraProcessingControl();
+	}
+
+	return processingControl;
+}
+
+
+void BartIO::CloseExams(const size_t keep)
+{
+	std::lock_guard<std::mutex> lock(examMutex);
+
+	while (examOrder.size() > keep) {
+
+		const std::string key = examOrder.back();
+		examOrder.pop_back();
+
+		debug_printf(DP_DEBUG1, "Closing Pfile %s\n", key.c_str());
+
+		pfiles.erase(key);
+		controls.erase(std::make_pair(key, false));
+		controls.erase(std::make_pair(key, true));
+	}
+}
@@ -0,0 +1,49 @@
+/* Copyright 2018. The Regents of the University of California.
+ * Copyright 2011-2018 General Electric Company. All rights reserved.
+ * GE Proprietary and Confidential Information. Only to be distributed with
+ * permission from GE. Resulting outputs are not for diagnostic purposes.
+ */
+
+#pragma once
+
+#include <boost/filesystem.hpp>
+#include <boost/shared_ptr.hpp>
+
+
+namespace GERecon
+{
+	namespace Legacy
+	{
+		class Pfile;
+		typedef boost::shared_ptr<Pfile> PfilePointer;
+	}
+
+	namespace Control
+	{
+		class ProcessingControl;
+		typedef boost::shared_ptr<ProcessingControl> ProcessingControlPointer;
+	}
+
+	namespace BartIO
+	{
+
+		/**
+		 * Pfile of an exam, opened once per process. Tools chained in one
+		 * ox-bart run share the Pfile instead of parsing its header again.
+		 */
+		Legacy::PfilePointer OpenPfile(const boost::filesystem::path& pfilePath);
+
+		/**
+		 * Processing control of the Pfile from OpenPfile, created once.
+		 *
+		 * @param lxControl create it from the Cartesian2D LxControlSource
+		 */
+		Control::ProcessingControlPointer PfileProcessingControl(const boost::filesystem::path& pfilePath, const bool lxControl = false);
+
+		/**
+		 * Keep only the most recently used exams. A long-running process
+		 * calls this between jobs, so it does not hold every exam it saw.
+		 */
+		void CloseExams(const size_t keep);
+	}
+}
@@ -0,0 +1,208 @@
+/* Copyright 2017. The Regents of the University of California.
+ * Copyright 2011-2017 General Electric Company. All rights reserved.
+ * GE Proprietary and Confidential Information. Only to be distributed with
+ * permission from GE. Resulting outputs are not for diagnostic purposes.
+ */
+
+#include <stdint.h>
+#include <math.h>
+
+#include <omp.h>
+
+#include <fftw3.h>
+
+// includes for bart
+#include "misc/mri.h"
+#include "misc/misc.h"
+
+#include "num/multind.h"
+#include "num/flpmath.h"
+#include "num/fft.h"
+
+#include "FusedFFT.h"
+
+
+using namespace GERecon;
+
+
+BartIO::FusedFFT::FusedFFT(const unsigned int N, const long dims[], const unsigned long fftmod_flags, const unsigned long ifft_flags, const unsigned long fft_flags, const bool threaded)
+	: N(N), dims(dims, dims + N), pending(NULL)
+{
+	const unsigned long nontriv = md_nontriv_dims(N, dims);
+
+	// plans are created with FFTW_ESTIMATE, which does not touch the buffer
+	_Complex float* tmp = (_Complex float*)md_alloc(N, dims, CFL_SIZE);
+
+	// the planner thread count is global, so the caller's value is put back
+	const int planThreads = fftwf_planner_nthreads();
+
+	if (!threaded)
+		fft_set_num_threads(1);
+
+	// fftmod
+	if (0 != (fftmod_flags & nontriv))
+		Modulate(fftmod_flags & nontriv, false, false);
+
+	// fft -iu: ifftmod, ifft, ifftmod, scale
+	if (0 != (ifft_flags & nontriv)) {
+
+		Modulate(ifft_flags & nontriv, true, false);
+		Flush();
+
+		const Step step = { NULL, fft_create(N, dims, ifft_flags & nontriv, tmp, tmp, true) };
+		steps.push_back(step);
+
+		Modulate(ifft_flags & nontriv, true, true);
+	}
+
+	// fft -u: fftmod, fft, fftmod, scale
+	if (0 != (fft_flags & nontriv)) {
+
+		Modulate(fft_flags & nontriv, false, false);
+		Flush();
+
+		const Step step = { NULL, fft_create(N, dims, fft_flags & nontriv, tmp, tmp, false) };
+		steps.push_back(step);
+
+		Modulate(fft_flags & nontriv, false, true);
+	}
+
+	Flush();
+
+	if (!threaded)
+		fft_set_num_threads(planThreads);
+
+	md_free(tmp);
+}
+
+
+BartIO::FusedFFT::~FusedFFT()
+{
+	for (size_t i = 0; i < steps.size(); i++) {
+
+		if (NULL != steps[i].diag)
+			md_free(steps[i].diag);
+
+		if (NULL != steps[i].plan)
+			fft_free(steps[i].plan);
+	}
+}
+
+
+/*
+ * Multiply the pending diagonal by the (i)fftmod pattern along flags and,
+ * after a transform, by the unitary scaling.
+ */
+void BartIO::FusedFFT::Modulate(const unsigned long flags, const bool inverse, const bool scale)
+{
+	if (NULL == pending) {
+
+		pending = (_Complex float*)md_alloc(N, dims.data(), CFL_SIZE);
+		md_zfill(N, dims.data(), pending, 1.);
+	}
+
+	if (inverse)
+		ifftmod(N, dims.data(), flags, pending, pending);
+	else
+		fftmod(N, dims.data(), flags, pending, pending);
+
+	if (scale)
+		fftscale(N, dims.data(), flags, pending, pending);
+}
+
+
+/*
+ * Push the pending diagonal as a step
+ */
+void BartIO::FusedFFT::Flush()
+{
+	if (NULL != pending) {
+
+		const Step step = { pending, NULL };
+		steps.push_back(step);
+	}
+
+	pending = NULL;
+}
+
+
+void BartIO::FusedFFT::Apply(_Complex float* block) const
+{
+	for (size_t i = 0; i < steps.size(); i++) {
+
+		if (NULL != steps[i].diag)
+			md_zmul(N, dims.data(), block, block, steps[i].diag);
+		else
+			fft_exec(steps[i].plan, block, block);
+	}
+}
+
+
+void BartIO::FusedFFTApply(const unsigned int N, const long dims[], const long strs[], _Complex float* data, const unsigned long fftmod_flags, const unsigned long ifft_flags, const unsigned long fft_flags)
+{
+	const unsigned long flags = (fftmod_flags | ifft_flags | fft_flags) & md_nontriv_dims(N, dims);
+
+	if (0 == flags)
+		return;
+
+	// blocks span all dimensions up to the last transformed one
+	unsigned int B = N;
+
+	while (!MD_IS_SET(flags, B - 1))
+		B--;
+
+	long bdims[N];
+	md_select_dims(N, MD_BIT(B) - 1, bdims, dims);
+
+	long bstrs[N];
+	md_calc_strides(N, bstrs, bdims, CFL_SIZE);
+
+	long odims[N];
+	md_select_dims(N, ~(MD_BIT(B) - 1), odims, dims);
+
+	const long numBlocks = md_calc_size(N, odims);
+	const bool threaded = numBlocks < omp_get_max_threads();
+
+	// contiguous, aligned blocks are transformed in place
+	bool inplace = (0 == ((uintptr_t)data % 16)) && (0 == (md_calc_size(N, bdims) * CFL_SIZE) % 16);
+
+	for (unsigned int i = 0; i < B; i++)
+		inplace = inplace && ((1 == bdims[i]) || (strs[i] == bstrs[i]));
+
+	const BartIO::FusedFFT fused(N, bdims, fftmod_flags, ifft_flags, fft_flags, threaded);
+
+#pragma omp parallel if (!threaded)
+	{
+		_Complex float* tmp = inplace ? NULL : (_Complex float*)md_alloc(N, bdims, CFL_SIZE);
+
+#pragma omp for
+		for (long index = 0; index < numBlocks; index++) {
+
+			long pos[N];
+			md_set_dims(N, pos, 0);
+
+			long rest = index;
+
+			for (unsigned int i = B; i < N; i++) {
+
+				pos[i] = rest % odims[i];
+				rest /= odims[i];
+			}
+
+			_Complex float* block = (_Complex float*)((char*)data + md_calc_offset(N, strs, pos));
+
+			if (inplace) {
+
+				fused.Apply(block);
+				continue;
+			}
+
+			md_copy2(N, bdims, bstrs, tmp, strs, block, CFL_SIZE);
+			fused.Apply(tmp);
+			md_copy2(N, bdims, strs, block, bstrs, tmp, CFL_SIZE);
+		}
+
+		if (NULL != tmp)
+			md_free(tmp);
+	}
+}
@@ -0,0 +1,75 @@
+/* Copyright 2017. The Regents of the University of California.
+ * Copyright 2011-2017 General Electric Company. All rights reserved.
+ * GE Proprietary and Confidential Information. Only to be distributed with
+ * permission from GE. Resulting outputs are not for diagnostic purposes.
+ */
+
+#pragma once
+
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+
+
+struct operator_s;
+
+namespace GERecon
+{
+	namespace BartIO
+	{
+
+		/**
+		 * Combined bart fftmod, fft -iu and fft -u (applied in this order) on a block.
+		 *
+		 * The modulations and scalings before, between and after the transforms
+		 * are merged into one precomputed diagonal each, so a block is touched
+		 * once per diagonal and once per transform while it is in cache.
+		 */
+		class FusedFFT : private boost::noncopyable
+		{
+		public:
+
+			/**
+			 * @param N number of dimensions
+			 * @param dims block dimensions
+			 * @param threaded allow multi-threaded transforms. Use false when blocks are processed in parallel
+			 */
+			FusedFFT(const unsigned int N, const long dims[], const unsigned long fftmod_flags, const unsigned long ifft_flags, const unsigned long fft_flags, const bool threaded = false);
+
+			~FusedFFT();
+
+			bool IsIdentity() const { return steps.empty(); }
+
+			/**
+			 * Apply in place to a contiguous block allocated with md_alloc
+			 */
+			void Apply(_Complex float* block) const;
+
+		private:
+
+			void Modulate(const unsigned long flags, const bool inverse, const bool scale);
+
+			void Flush();
+
+			struct Step
+			{
+				_Complex float* diag;
+				const struct operator_s* plan;
+			};
+
+			const unsigned int N;
+			std::vector<long> dims;
+
+			std::vector<Step> steps;
+			_Complex float* pending;
+		};
+
+
+		/**
+		 * Apply bart fftmod, fft -iu and fft -u along flags to a strided array. The
+		 * array is processed in blocks spanning the dimensions up to the last flagged
+		 * one, each block with a single fused pass.
+		 */
+		void FusedFFTApply(const unsigned int N, const long dims[], const long strs[], _Complex float* data, const unsigned long fftmod_flags, const unsigned long ifft_flags, const unsigned long fft_flags);
+	}
+}
@@ -0,0 +1,145 @@
+/* Copyright 2017. The Regents of the University of California.
+ * Copyright 2011-2017 General Electric Company. All rights reserved.
+ * GE Proprietary and Confidential Information. Only to be distributed with
+ * permission from GE. Resulting outputs are not for diagnostic purposes.
+ */
+
+#include <algorithm>
+
+// includes for bart
+#include <assert.h>
+#include <stdlib.h>
+
+#include "misc/misc.h"
+#include "misc/debug.h"
+
+#include "Hdf5Dataset.h"
+
+
+using namespace GERecon;
+
+
+/*
+ * Compound of two values of type part, with the member names of the file type
+ */
+static hid_t ComplexType(const hid_t fileType, const hid_t part)
+{
+	const size_t size = H5Tget_size(part);
+	const hid_t type = H5Tcreate(H5T_COMPOUND, 2 * size);
+
+	for (unsigned int i = 0; i < 2; i++) {
+
+		char* name = H5Tget_member_name(fileType, i);
+		H5Tinsert(type, name, i * size, part);
+		H5free_memory(name);
+	}
+
+	return type;
+}
+
+
+BartIO::Hdf5Dataset::Hdf5Dataset(const std::string& fileName, const std::string& group, const std::string& name)
+	: file(-1), dataset(-1), floatType(-1), doubleType(-1), rows(0), cols(0)
+{
+	file = H5Fopen(fileName.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT);
+
+	if (file < 0)
+		error("Cannot open HDF5 file %s!\n", fileName.c_str());
+
+	const std::string path = "/" + group + "/" + name;
+
+	dataset = H5Dopen2(file, path.c_str(), H5P_DEFAULT);
+
+	if (dataset < 0)
+		error("No dataset %s in %s!\n", path.c_str(), fileName.c_str());
+
+	const hid_t fileType = H5Dget_type(dataset);
+
+	if ((H5T_COMPOUND != H5Tget_class(fileType)) || (2 != H5Tget_nmembers(fileType)))
+		error("Dataset %s is not complex!\n", path.c_str());
+
+	floatType = ComplexType(fileType, H5T_NATIVE_FLOAT);
+	doubleType = ComplexType(fileType, H5T_NATIVE_DOUBLE);
+
+	H5Tclose(fileType);
+
+	const hid_t space = H5Dget_space(dataset);
+
+	hsize_t dims[2] = { 1, 1 };
+	const int rank = H5Sget_simple_extent_ndims(space);
+
+	if ((rank < 1) || (rank > 2))
+		error("Dataset %s has rank %d, expected 2!\n", path.c_str(), rank);
+
+	H5Sget_simple_extent_dims(space, dims, NULL);
+	H5Sclose(space);
+
+	rows = (2 == rank) ? dims[0] : 1;
+	cols = (2 == rank) ? dims[1] : dims[0];
+
+	debug_printf(DP_DEBUG1, "Dataset %s: %ld x %ld\n", path.c_str(), rows, cols);
+}
+
+
+BartIO::Hdf5Dataset::~Hdf5Dataset()
+{
+	if (doubleType >= 0)
+		H5Tclose(doubleType);
+
+	if (floatType >= 0)
+		H5Tclose(floatType);
+
+	if (dataset >= 0)
+		H5Dclose(dataset);
+
+	if (file >= 0)
+		H5Fclose(file);
+}
+
+
+long BartIO::Hdf5Dataset::ChunkRows(const long maxBytes) const
+{
+	const long rowBytes = cols * sizeof(std::complex<double>);
+
+	return std::max(1L, std::min(rows, maxBytes / rowBytes));
+}
+
+
+void BartIO::Hdf5Dataset::Read(const long row, const long numRows, const long col, const long numCols, const hid_t memType, void* out) const
+{
+	assert((row >= 0) && (row + numRows <= rows));
+	assert((col >= 0) && (col + numCols <= cols));
+
+	const hid_t fileSpace = H5Dget_space(dataset);
+	const int rank = H5Sget_simple_extent_ndims(fileSpace);
+
+	const hsize_t start[2] = { (hsize_t)row, (hsize_t)col };
+	const hsize_t count[2] = { (hsize_t)numRows, (hsize_t)numCols };
+
+	// a rank 1 dataset is a single row
+	const int skip = (2 == rank) ? 0 : 1;
+
+	H5Sselect_hyperslab(fileSpace, H5S_SELECT_SET, start + skip, NULL, count + skip, NULL);
+
+	const hid_t memSpace = H5Screate_simple(rank, count + skip, NULL);
+
+	const herr_t status = H5Dread(dataset, memType, memSpace, fileSpace, H5P_DEFAULT, out);
+
+	H5Sclose(memSpace);
+	H5Sclose(fileSpace);
+
+	if (status < 0)
+		error("Reading HDF5 dataset failed!\n");
+}
+
+
+void BartIO::Hdf5Dataset::Read(const long row, const long numRows, const long col, const long numCols, _Complex float* out) const
+{
+	Read(row, numRows, col, numCols, floatType, out);
+}
+
+
+void BartIO::Hdf5Dataset::Read(const long row, const long numRows, const long col, const long numCols, std::complex<double>* out) const
+{
+	Read(row, numRows, col, numCols, doubleType, out);
+}
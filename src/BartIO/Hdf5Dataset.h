@@ -0,0 +1,77 @@
+/* Copyright 2017. The Regents of the University of California.
+ * Copyright 2011-2017 General Electric Company. All rights reserved.
+ * GE Proprietary and Confidential Information. Only to be distributed with
+ * permission from GE. Resulting outputs are not for diagnostic purposes.
+ */
+
+#pragma once
+
+#include <complex>
+#include <string>
+
+#include <boost/noncopyable.hpp>
+
+#include <hdf5.h>
+
+
+namespace GERecon
+{
+	namespace BartIO
+	{
+
+		/**
+		 * Complex 2D dataset of an HDF5 file, read in hyperslabs.
+		 *
+		 * Elements are compounds of a real and an imaginary part, as written
+		 * by GEHdf5. HDF5 converts them to the requested precision while
+		 * reading, so a chunk goes from the file to its destination in one
+		 * copy and only the chunk is held in memory.
+		 */
+		class Hdf5Dataset : private boost::noncopyable
+		{
+		public:
+
+			/**
+			 * @param group group of the dataset, e.g. "Data"
+			 */
+			Hdf5Dataset(const std::string& fileName, const std::string& group, const std::string& name);
+
+			~Hdf5Dataset();
+
+			/**
+			 * Size of the slower (rows) and faster (columns) varying dimension
+			 */
+			long Rows() const { return rows; }
+
+			long Cols() const { return cols; }
+
+			/**
+			 * Read rows [row, row + numRows) and columns [col, col + numCols)
+			 *
+			 * @param out row-major: out[r * numCols + c]
+			 */
+			void Read(const long row, const long numRows, const long col, const long numCols, _Complex float* out) const;
+
+			void Read(const long row, const long numRows, const long col, const long numCols, std::complex<double>* out) const;
+
+			/**
+			 * Number of rows of a chunk of at most maxBytes
+			 */
+			long ChunkRows(const long maxBytes) const;
+
+		private:
+
+			void Read(const long row, const long numRows, const long col, const long numCols, const hid_t memType, void* out) const;
+
+			hid_t file;
+			hid_t dataset;
+
+			// memory types of complex float and double, matching the file type
+			hid_t floatType;
+			hid_t doubleType;
+
+			long rows;
+			long cols;
+		};
+	}
+}
@@ -0,0 +1,262 @@
+/* Copyright 2017. The Regents of the University of California.
+ * Copyright 2011-2017 General Electric Company. All rights reserved.
+ * GE Proprietary and Confidential Information. Only to be distributed with
+ * permission from GE. Resulting outputs are not for diagnostic purposes.
+ */
+
+#include <map>
+#include <tuple>
+
+#include <math.h>
+
+#include <Orchestra/Common/SliceOrientation.h>
+#include <Orchestra/Core/RotateTranspose.h>
+
+// includes for bart
+#include "misc/misc.h"
+
+#include "ImageKernels.h"
+
+
+/*
+ * AVX2 and AVX-512 kernels are compiled for their target and chosen at run
+ * time by the processor. This needs intrinsics usable in functions with a
+ * target attribute (gcc 4.9, clang)
+ */
+#if defined(__x86_64__) && (defined(__clang__) || (__GNUC__ > 4) || ((4 == __GNUC__) && (__GNUC_MINOR__ >= 9)))
+#include <immintrin.h>
+#define IMAGE_KERNELS_AVX2
+#endif
+
+#if defined(IMAGE_KERNELS_AVX2) && (defined(__clang__) || (__GNUC__ >= 5))
+#define IMAGE_KERNELS_AVX512
+#endif
+
+
+using namespace GERecon;
+using namespace MDArray;
+
+
+/*
+ * Range of magnitude images, as clipped by Clipper::Apply(image, MagnitudeImage)
+ */
+static const float MinMagnitude = 0.;
+static const float MaxMagnitude = 32767.;
+
+
+enum SimdLevel { Scalar, AVX2, AVX512 };
+
+static SimdLevel CpuSimdLevel()
+{
+#if defined(IMAGE_KERNELS_AVX512)
+	if (__builtin_cpu_supports("avx512f"))
+		return AVX512;
+#endif
+#if defined(IMAGE_KERNELS_AVX2)
+	if (__builtin_cpu_supports("avx2"))
+		return AVX2;
+#endif
+	return Scalar;
+}
+
+static const SimdLevel simdLevel = CpuSimdLevel();
+
+
+#if defined(IMAGE_KERNELS_AVX512)
+__attribute__((target("avx512f")))
+static long MagnitudeAVX512(float* out, const float* src, const long n, const float scale)
+{
+	const __m512i re = _mm512_setr_epi32(0, 2, 4, 6, 8, 10, 12, 14, 16, 18, 20, 22, 24, 26, 28, 30);
+	const __m512i im = _mm512_setr_epi32(1, 3, 5, 7, 9, 11, 13, 15, 17, 19, 21, 23, 25, 27, 29, 31);
+	const __m512 s = _mm512_set1_ps(scale);
+
+	long i = 0;
+
+	for (; i + 16 <= n; i += 16) {
+
+		const __m512 a = _mm512_loadu_ps(src + 2 * i);
+		const __m512 b = _mm512_loadu_ps(src + 2 * i + 16);
+
+		const __m512 x = _mm512_permutex2var_ps(a, re, b);
+		const __m512 y = _mm512_permutex2var_ps(a, im, b);
+
+		const __m512 m = _mm512_sqrt_ps(_mm512_fmadd_ps(x, x, _mm512_mul_ps(y, y)));
+
+		_mm512_storeu_ps(out + i, _mm512_mul_ps(s, m));
+	}
+
+	return i;
+}
+#endif
+
+
+#if defined(IMAGE_KERNELS_AVX2)
+__attribute__((target("avx2")))
+static long MagnitudeAVX2(float* out, const float* src, const long n, const float scale)
+{
+	const __m256 s = _mm256_set1_ps(scale);
+
+	long i = 0;
+
+	for (; i + 8 <= n; i += 8) {
+
+		const __m256 a = _mm256_loadu_ps(src + 2 * i);
+		const __m256 b = _mm256_loadu_ps(src + 2 * i + 8);
+
+		// squared magnitudes in the order 0 1 4 5 | 2 3 6 7
+		const __m256 h = _mm256_hadd_ps(_mm256_mul_ps(a, a), _mm256_mul_ps(b, b));
+		const __m256 m = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(h), _MM_SHUFFLE(3, 1, 2, 0)));
+
+		_mm256_storeu_ps(out + i, _mm256_mul_ps(s, _mm256_sqrt_ps(m)));
+	}
+
+	return i;
+}
+#endif
+
+
+void BartIO::MagnitudeKernel(float* out, const _Complex float* in, const long n, const float scale)
+{
+	const float* src = (const float*)in;
+	long i = 0;
+
+	switch (simdLevel) {
+#if defined(IMAGE_KERNELS_AVX512)
+	case AVX512:
+		i = MagnitudeAVX512(out, src, n, scale);
+		break;
+#endif
+#if defined(IMAGE_KERNELS_AVX2)
+	case AVX2:
+		i = MagnitudeAVX2(out, src, n, scale);
+		break;
+#endif
+	default:
+		break;
+	}
+
+	for (; i < n; i++)
+		out[i] = scale * sqrtf(src[2 * i] * src[2 * i] + src[2 * i + 1] * src[2 * i + 1]);
+}
+
+
+const BartIO::RotateTransposeTable& BartIO::RotateTransposeIndex(const int rows, const int cols, const SliceOrientation& sliceOrientation)
+{
+	typedef std::tuple<int, int, int, int> Key;
+
+	static thread_local std::map<Key, RotateTransposeTable> tables;
+
+	const Key key(rows, cols, (int)sliceOrientation.RotationType(), (int)sliceOrientation.TransposeType());
+
+	std::map<Key, RotateTransposeTable>::iterator it = tables.find(key);
+
+	if (tables.end() != it)
+		return it->second;
+
+	// float holds indices exactly up to 2^24 pixels
+	if ((long)rows * cols > (1L << 24))
+		error("Image of %d x %d pixels is too large to rotate!\n", rows, cols);
+
+	FloatMatrix indexImage(rows, cols);
+	float* idx = indexImage.data();
+
+	for (long i = 0; i < (long)rows * cols; i++)
+		idx[i] = i;
+
+	const FloatMatrix rotated = RotateTranspose::Apply<float>(indexImage, sliceOrientation.RotationType(), sliceOrientation.TransposeType());
+
+	RotateTransposeTable& table = tables[key];
+
+	table.shape = rotated.shape();
+	table.index.resize((long)rows * cols);
+
+	const float* ridx = rotated.data();
+
+	for (long i = 0; i < (long)rows * cols; i++)
+		table.index[i] = (int32_t)ridx[i];
+
+	return table;
+}
+
+
+#if defined(IMAGE_KERNELS_AVX512)
+__attribute__((target("avx512f")))
+static long RotateClipAVX512(short* dst, const float* src, const int32_t* index, const long n)
+{
+	const __m512 lo = _mm512_set1_ps(MinMagnitude);
+	const __m512 hi = _mm512_set1_ps(MaxMagnitude);
+
+	long i = 0;
+
+	for (; i + 16 <= n; i += 16) {
+
+		const __m512i j = _mm512_loadu_si512((const void*)(index + i));
+		const __m512 v = _mm512_min_ps(_mm512_max_ps(_mm512_i32gather_ps(j, src, 4), lo), hi);
+
+		_mm256_storeu_si256((__m256i*)(dst + i), _mm512_cvtsepi32_epi16(_mm512_cvttps_epi32(v)));
+	}
+
+	return i;
+}
+#endif
+
+
+#if defined(IMAGE_KERNELS_AVX2)
+__attribute__((target("avx2")))
+static long RotateClipAVX2(short* dst, const float* src, const int32_t* index, const long n)
+{
+	const __m256 lo = _mm256_set1_ps(MinMagnitude);
+	const __m256 hi = _mm256_set1_ps(MaxMagnitude);
+
+	long i = 0;
+
+	for (; i + 16 <= n; i += 16) {
+
+		const __m256i j0 = _mm256_loadu_si256((const __m256i*)(index + i));
+		const __m256i j1 = _mm256_loadu_si256((const __m256i*)(index + i + 8));
+
+		const __m256 v0 = _mm256_min_ps(_mm256_max_ps(_mm256_i32gather_ps(src, j0, 4), lo), hi);
+		const __m256 v1 = _mm256_min_ps(_mm256_max_ps(_mm256_i32gather_ps(src, j1, 4), lo), hi);
+
+		// packs works per 128 bit lane: restore the order of the four quarters
+		const __m256i p = _mm256_packs_epi32(_mm256_cvttps_epi32(v0), _mm256_cvttps_epi32(v1));
+
+		_mm256_storeu_si256((__m256i*)(dst + i), _mm256_permute4x64_epi64(p, _MM_SHUFFLE(3, 1, 2, 0)));
+	}
+
+	return i;
+}
+#endif
+
+
+void BartIO::RotateClipKernel(ShortMatrix& out, const FloatMatrix& in, const RotateTransposeTable& table)
+{
+	const float* src = in.data();
+	const int32_t* index = table.index.data();
+	short* dst = out.data();
+
+	const long n = table.index.size();
+	long i = 0;
+
+	switch (simdLevel) {
+#if defined(IMAGE_KERNELS_AVX512)
+	case AVX512:
+		i = RotateClipAVX512(dst, src, index, n);
+		break;
+#endif
+#if defined(IMAGE_KERNELS_AVX2)
+	case AVX2:
+		i = RotateClipAVX2(dst, src, index, n);
+		break;
+#endif
+	default:
+		break;
+	}
+
+	for (; i < n; i++) {
+
+		const float v = src[index[i]];
+
+		dst[i] = (short)((v > MinMagnitude) ? ((v < MaxMagnitude) ? v : MaxMagnitude) : MinMagnitude);
+	}
+}
@@ -0,0 +1,55 @@
+/* Copyright 2017. The Regents of the University of California.
+ * Copyright 2011-2017 General Electric Company. All rights reserved.
+ * GE Proprietary and Confidential Information. Only to be distributed with
+ * permission from GE. Resulting outputs are not for diagnostic purposes.
+ */
+
+#pragma once
+
+#include <vector>
+
+#include <stdint.h>
+
+#include <MDArray/MDArray.h>
+
+
+namespace GERecon
+{
+	class SliceOrientation;
+
+	namespace BartIO
+	{
+
+		/**
+		 * out = scale * |in| for n complex values. Vectorized with AVX2 or
+		 * AVX-512 when the processor supports them.
+		 */
+		void MagnitudeKernel(float* out, const _Complex float* in, const long n, const float scale = 1.);
+
+
+		/**
+		 * Source index of every pixel of a rotated and transposed image
+		 */
+		struct RotateTransposeTable
+		{
+			MDArray::TinyVector<int, 2> shape;
+			std::vector<int32_t> index;
+		};
+
+
+		/**
+		 * Table for RotateTranspose::Apply with the rotation and transpose of
+		 * a slice. The table is computed by applying RotateTranspose to an
+		 * image of pixel indices, so it matches the Orchestra convention
+		 * exactly. Tables are cached per thread.
+		 */
+		const RotateTransposeTable& RotateTransposeIndex(const int rows, const int cols, const SliceOrientation& sliceOrientation);
+
+
+		/**
+		 * Rotate/transpose, clip to the range of magnitude images and convert
+		 * to short in one pass: out[j] = short(clip(in[table.index[j]]))
+		 */
+		void RotateClipKernel(MDArray::ShortMatrix& out, const MDArray::FloatMatrix& in, const RotateTransposeTable& table);
+	}
+}
@@ -0,0 +1,215 @@
+/* Copyright 2017. The Regents of the University of California.
+ * Copyright 2011-2017 General Electric Company. All rights reserved.
+ * GE Proprietary and Confidential Information. Only to be distributed with
+ * permission from GE. Resulting outputs are not for diagnostic purposes.
+ */
+
+#include <algorithm>
+
+#include <cblas.h>
+#include <lapacke.h>
+
+// includes for bart
+#include <assert.h>
+
+#include "misc/mri.h"
+#include "misc/misc.h"
+#include "misc/mmio.h"
+#include "misc/debug.h"
+
+#include "num/multind.h"
+
+#include "Hdf5Dataset.h"
+#include "NoiseWhitening.h"
+
+
+using namespace GERecon;
+
+
+/*
+ * Samples converted to double precision at a time
+ */
+static const long BlockSamples = 4096;
+
+
+BartIO::NoiseCovariance::NoiseCovariance(const long numChannels)
+	: numChannels(numChannels), numSamples(0), sum(numChannels * numChannels, 0.)
+{
+}
+
+
+void BartIO::NoiseCovariance::Accumulate(const long n, const std::complex<double>* noise)
+{
+	if (0 == n)
+		return;
+
+	// sum += noise^H noise, multi-threaded by BLAS
+	cblas_zherk(CblasColMajor, CblasUpper, CblasConjTrans, numChannels, n, 1., noise, n, 1., sum.data(), numChannels);
+
+	numSamples += n;
+}
+
+
+void BartIO::NoiseCovariance::Accumulate(const long n, const _Complex float* noise)
+{
+	std::vector<std::complex<double> > block(std::min(n, BlockSamples) * numChannels);
+
+	for (long s = 0; s < n; s += BlockSamples) {
+
+		const long len = std::min(BlockSamples, n - s);
+
+#pragma omp parallel for
+		for (long c = 0; c < numChannels; c++)
+			for (long i = 0; i < len; i++) {
+
+				const _Complex float z = noise[c * n + s + i];
+				block[c * len + i] = std::complex<double>(__real__ z, __imag__ z);
+			}
+
+		Accumulate(len, block.data());
+	}
+}
+
+
+void BartIO::NoiseCovariance::Covariance(_Complex float* cov) const
+{
+	if (numSamples < 2)
+		error("Need at least two noise samples for the covariance, got %ld\n", numSamples);
+
+	const long C = numChannels;
+	const double scale = 1. / (numSamples - 1);
+
+	for (long j = 0; j < C; j++)
+		for (long i = 0; i <= j; i++) {
+
+			const std::complex<double> m = scale * sum[i + C * j];
+
+			// cov_ij = conj(m_ij), cov_ji = m_ij
+			__real__ cov[i + C * j] = m.real();
+			__imag__ cov[i + C * j] = -m.imag();
+			__real__ cov[j + C * i] = m.real();
+			__imag__ cov[j + C * i] = m.imag();
+		}
+}
+
+
+void BartIO::NoiseCovariance::Whitening(_Complex float* w) const
+{
+	std::vector<_Complex float> cov(numChannels * numChannels);
+	Covariance(cov.data());
+
+	BartIO::CholeskyWhitening(numChannels, w, cov.data());
+
+	debug_printf(DP_DEBUG1, "Whitening from %ld noise samples of %ld channels\n", numSamples, numChannels);
+}
+
+
+boost::shared_ptr<BartIO::NoiseCovariance> BartIO::ReadNoiseCovariance(const std::string& fileName, const long chunkBytes)
+{
+	// NoiseData is [Channel][Samples]: a hyperslab of all channels is [Samples, Channel]
+	const BartIO::Hdf5Dataset noiseData(fileName, "Data", "NoiseData");
+
+	const long C = noiseData.Rows();
+	const long N = noiseData.Cols();
+
+	boost::shared_ptr<BartIO::NoiseCovariance> noiseCov(new BartIO::NoiseCovariance(C));
+
+	const long chunk = std::max(1L, std::min(N, chunkBytes / (C * (long)sizeof(std::complex<double>))));
+
+	std::vector<std::complex<double> > block(C * chunk);
+
+	for (long s = 0; s < N; s += chunk) {
+
+		const long len = std::min(chunk, N - s);
+
+		noiseData.Read(0, C, s, len, block.data());
+		noiseCov->Accumulate(len, block.data());
+	}
+
+	return noiseCov;
+}
+
+
+void BartIO::CholeskyWhitening(const long C, _Complex float* w, const _Complex float* cov)
+{
+	std::vector<std::complex<double> > L(C * C);
+
+	for (long i = 0; i < C * C; i++)
+		L[i] = std::complex<double>(__real__ cov[i], __imag__ cov[i]);
+
+	if (0 != LAPACKE_zpotrf(LAPACK_COL_MAJOR, 'L', C, (lapack_complex_double*)L.data(), C))
+		error("Noise covariance is not positive definite!\n");
+
+	if (0 != LAPACKE_ztrtri(LAPACK_COL_MAJOR, 'L', 'N', C, (lapack_complex_double*)L.data(), C))
+		error("Inversion of the Cholesky factor failed!\n");
+
+	for (long j = 0; j < C; j++)
+		for (long i = 0; i < C; i++) {
+
+			// only the lower triangle is set
+			const std::complex<double> z = (i >= j) ? L[i + C * j] : std::complex<double>(0.);
+
+			__real__ w[i + C * j] = z.real();
+			__imag__ w[i + C * j] = z.imag();
+		}
+}
+
+
+std::vector<_Complex float> BartIO::LoadWhitening(const std::string& name, const long numChannels, const Selection& selection)
+{
+	const long C = numChannels;
+
+	std::vector<_Complex float> cov(C * C);
+
+	if (boost::filesystem::path(name).extension() == ".h5") {
+
+		const boost::shared_ptr<BartIO::NoiseCovariance> noiseCov = BartIO::ReadNoiseCovariance(name);
+
+		if (noiseCov->ChannelCount() != C)
+			error("Noise data has %ld channels, the scan %ld!\n", noiseCov->ChannelCount(), C);
+
+		noiseCov->Covariance(cov.data());
+
+	} else {
+
+		long dims[DIMS];
+		_Complex float* data = load_cfl(name.c_str(), DIMS, dims);
+
+		if ((dims[COIL_DIM] != C) || (dims[MAPS_DIM] != C) || (md_calc_size(DIMS, dims) != C * C))
+			error("Noise covariance must be [%ld, %ld] along the coil and maps dims!\n", C, C);
+
+		std::copy(data, data + C * C, cov.begin());
+
+		unmap_cfl(DIMS, dims, data);
+	}
+
+	// covariance of the selected channels
+	long sdims[PFILE_DIMS];
+	long fdims[PFILE_DIMS];
+	md_singleton_dims(PFILE_DIMS, fdims);
+	fdims[4] = C;
+	selection.Dims(sdims, fdims);
+
+	const long start = selection.start[4];
+	const long S = sdims[4];
+
+	std::vector<_Complex float> scov(S * S);
+
+	for (long j = 0; j < S; j++)
+		for (long i = 0; i < S; i++)
+			scov[i + S * j] = cov[(start + i) + C * (start + j)];
+
+	std::vector<_Complex float> whitening(S * S);
+	BartIO::CholeskyWhitening(S, whitening.data(), scov.data());
+
+	return whitening;
+}
+
+
+void BartIO::WhitenChannels(const long n, const long C, const long ldo, _Complex float* out, const long ldi, const _Complex float* in, const _Complex float* w)
+{
+	const _Complex float one = 1.;
+	const _Complex float zero = 0.;
+
+	cblas_cgemm(CblasColMajor, CblasNoTrans, CblasTrans, n, C, C, &one, in, ldi, w, C, &zero, out, ldo);
+}
@@ -0,0 +1,112 @@
+/* Copyright 2017. The Regents of the University of California.
+ * Copyright 2011-2017 General Electric Company. All rights reserved.
+ * GE Proprietary and Confidential Information. Only to be distributed with
+ * permission from GE. Resulting outputs are not for diagnostic purposes.
+ */
+
+#pragma once
+
+#include <complex>
+#include <string>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include "BartIO.h"
+
+
+namespace GERecon
+{
+	namespace BartIO
+	{
+
+		/**
+		 * Channel noise covariance accumulated from raw noise samples.
+		 *
+		 * Samples are added in blocks of [Samples, Channel] with a Hermitian
+		 * rank-k update (BLAS zherk) in double precision, so noise can be
+		 * streamed through in pieces of any size. The covariance is
+		 * cov[i + C * j] = sum_s x_i(s) conj(x_j(s)) / (N - 1).
+		 */
+		class NoiseCovariance : private boost::noncopyable
+		{
+		public:
+
+			NoiseCovariance(const long numChannels);
+
+			/**
+			 * Add noise samples
+			 *
+			 * @param noise [Samples, Channel], column-major
+			 */
+			void Accumulate(const long numSamples, const std::complex<double>* noise);
+
+			void Accumulate(const long numSamples, const _Complex float* noise);
+
+			long ChannelCount() const { return numChannels; }
+
+			long SampleCount() const { return numSamples; }
+
+			/**
+			 * @param cov [Channel, Channel]
+			 */
+			void Covariance(_Complex float* cov) const;
+
+			/**
+			 * Whitening matrix W = L^-1 with cov = L L^H (Cholesky), lower
+			 * triangular. Whitened channels y = W x have unit covariance.
+			 *
+			 * @param w [Channel, Channel]
+			 */
+			void Whitening(_Complex float* w) const;
+
+		private:
+
+			const long numChannels;
+			long numSamples;
+
+			// upper triangle of sum_s x(s)^* x(s)^T
+			std::vector<std::complex<double> > sum;
+		};
+
+
+		/**
+		 * Covariance of the NoiseData samples of a noise statistics file.
+		 * The samples are read in hyperslabs of at most chunkBytes.
+		 */
+		boost::shared_ptr<NoiseCovariance> ReadNoiseCovariance(const std::string& fileName, const long chunkBytes = 16 * 1024 * 1024);
+
+
+		/**
+		 * Whitening matrix W = L^-1 of a covariance cov = L L^H
+		 *
+		 * @param w [Channel, Channel], lower triangular
+		 * @param cov [Channel, Channel]
+		 */
+		void CholeskyWhitening(const long numChannels, _Complex float* w, const _Complex float* cov);
+
+
+		/**
+		 * Whitening matrix of the selected channels from a noise statistics
+		 * file (.h5), computed from its noise samples, or from a bart
+		 * covariance [Coil, Coil] as written by NoiseCov --covar.
+		 *
+		 * @param numChannels number of channels of the scan
+		 * @return [Channel, Channel] for the selected channels
+		 */
+		std::vector<_Complex float> LoadWhitening(const std::string& name, const long numChannels, const Selection& selection);
+
+
+		/**
+		 * Mix the channels of a block: out = in W^T, i.e. channel i of out is
+		 * sum_j w[i + C * j] in_j. A small complex GEMM on data that fits in
+		 * cache; out and in must not overlap.
+		 *
+		 * @param n samples per channel
+		 * @param ldo distance between channels of out (elements)
+		 * @param ldi distance between channels of in (elements)
+		 */
+		void WhitenChannels(const long n, const long numChannels, const long ldo, _Complex float* out, const long ldi, const _Complex float* in, const _Complex float* w);
+	}
+}
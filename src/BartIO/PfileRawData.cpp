@@ -0,0 +1,236 @@
+/* Copyright 2017. The Regents of the University of California.
+ * Copyright 2011-2017 General Electric Company. All rights reserved.
+ * GE Proprietary and Confidential Information. Only to be distributed with
+ * permission from GE. Resulting outputs are not for diagnostic purposes.
+ */
+
+// includes for orchestra
+#include <Orchestra/Legacy/Pfile.h>
+#include <Orchestra/Legacy/LxDownloadData.h>
+
+// system includes
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// includes for bart
+#include <assert.h>
+#include <math.h>
+
+#include "misc/mri.h"
+#include "misc/debug.h"
+
+#include "num/multind.h"
+#include "num/flpmath.h"
+
+#include "PfileRawData.h"
+
+
+// Include this to avoid having to type fully qualified names
+using namespace GERecon;
+using namespace MDArray;
+
+
+/*
+ * Raw header only contains the data offset from this revision on
+ */
+static const float minRawRevision = 11.;
+
+
+BartIO::PfileRawData::PfileRawData(const boost::filesystem::path& pfilePath, const Legacy::PfilePointer& pfile, const float pfileVersion)
+	: fd(-1), mapSize(0), base(NULL)
+{
+	if (pfileVersion < minRawRevision) {
+
+		debug_printf(DP_DEBUG1, "Pfile revision %.3f has no raw data offset. Not mapping raw data.\n", pfileVersion);
+		return;
+	}
+
+	const Legacy::LxDownloadDataPointer downloadData = pfile->DownloadData();
+	const auto& rawHeader = downloadData->RawHeader();
+
+	dataOffset = rawHeader.rdb_hdr_off_data;
+	pointSize = rawHeader.rdb_hdr_point_size;
+	frameSize = rawHeader.rdb_hdr_frame_size;
+	numViews = rawHeader.rdb_hdr_nframes + rawHeader.rdb_hdr_hnover;
+	numSlices = rawHeader.rdb_hdr_nslices;
+	numEchoes = rawHeader.rdb_hdr_nechoes;
+	numChannels = pfile->ChannelCount();
+	numPasses = pfile->PassCount();
+
+	if ((2 != pointSize) && (4 != pointSize)) {
+
+		debug_printf(DP_DEBUG1, "Unsupported raw point size %ld. Not mapping raw data.\n", pointSize);
+		return;
+	}
+
+	// one baseline view is stored in front of every block
+	viewBytes = frameSize * 2 * pointSize;
+	blockBytes = (numViews + 1) * viewBytes;
+	passBytes = numChannels * numSlices * numEchoes * blockBytes;
+
+	if ((rawHeader.rdb_hdr_raw_pass_size > 0) && (rawHeader.rdb_hdr_raw_pass_size >= passBytes))
+		passBytes = rawHeader.rdb_hdr_raw_pass_size;
+
+	fd = open(pfilePath.string().c_str(), O_RDONLY);
+
+	if (-1 == fd) {
+
+		debug_printf(DP_WARN, "Could not open %s for mapping.\n", pfilePath.string().c_str());
+		return;
+	}
+
+	struct stat st;
+
+	if ((-1 == fstat(fd, &st)) || (st.st_size < dataOffset + numPasses * passBytes)) {
+
+		debug_printf(DP_DEBUG1, "Raw header does not match Pfile size. Not mapping raw data.\n");
+		close(fd);
+		fd = -1;
+		return;
+	}
+
+	mapSize = st.st_size;
+
+	void* addr = mmap(NULL, mapSize, PROT_READ, MAP_SHARED, fd, 0);
+
+	if (MAP_FAILED == addr) {
+
+		debug_printf(DP_WARN, "Could not map %s.\n", pfilePath.string().c_str());
+		close(fd);
+		fd = -1;
+		return;
+	}
+
+	madvise(addr, mapSize, MADV_SEQUENTIAL);
+
+	base = (const char*)addr;
+}
+
+
+BartIO::PfileRawData::~PfileRawData()
+{
+	if (NULL != base)
+		munmap((void*)base, mapSize);
+
+	if (-1 != fd)
+		close(fd);
+}
+
+
+bool BartIO::PfileRawData::IsValid() const
+{
+	return NULL != base;
+}
+
+
+const char* BartIO::PfileRawData::BlockPointer(const int pass, const int slice, const int echo, const int channel) const
+{
+	assert(IsValid());
+	assert((pass < numPasses) && (slice < numSlices) && (echo < numEchoes) && (channel < numChannels));
+
+	const long offset = dataOffset + pass * passBytes + ((channel * numSlices + slice) * numEchoes + echo) * blockBytes;
+
+	// skip baseline view
+	return base + offset + viewBytes;
+}
+
+
+void BartIO::PfileRawData::Convert(_Complex float* out, const long ostrs[2], const char* in) const
+{
+	const bool contiguous = (CFL_SIZE == ostrs[0]) && ((long)(frameSize * CFL_SIZE) == ostrs[1]);
+
+	const long rows = contiguous ? 1 : numViews;
+	const long cols = contiguous ? frameSize * numViews : frameSize;
+
+	for (long v = 0; v < rows; v++) {
+
+		char* dst = (char*)out + v * ostrs[1];
+
+		if (2 == pointSize) {
+
+			const int16_t* src = (const int16_t*)in + 2 * v * frameSize;
+
+			for (long r = 0; r < cols; r++) {
+
+				float* d = (float*)(dst + r * ostrs[0]);
+				d[0] = (float)src[2 * r];
+				d[1] = (float)src[2 * r + 1];
+			}
+
+		} else {
+
+			const int32_t* src = (const int32_t*)in + 2 * v * frameSize;
+
+			for (long r = 0; r < cols; r++) {
+
+				float* d = (float*)(dst + r * ostrs[0]);
+				d[0] = (float)src[2 * r];
+				d[1] = (float)src[2 * r + 1];
+			}
+		}
+	}
+}
+
+
+void BartIO::PfileRawData::Read(_Complex float* out, const long ostrs[2], const int pass, const int slice, const int echo, const int channel) const
+{
+	Convert(out, ostrs, BlockPointer(pass, slice, echo, channel));
+}
+
+
+void BartIO::PfileRawData::Copy(char* out, const int pass, const int slice, const int echo, const int channel) const
+{
+	memcpy(out, BlockPointer(pass, slice, echo, channel), BlockBytes());
+}
+
+
+bool BartIO::PfileRawData::Verify(const Legacy::PfilePointer& pfile, const int pass, const int slice, const int echo, const int channel) const
+{
+	ComplexFloatMatrix kSpace;
+
+	if (pfile->IsZEncoded()) {
+
+		const ComplexFloatMatrix kSpace1 = pfile->KSpaceData<float>(Legacy::Pfile::PassSlicePair(pass, slice), echo, channel);
+		kSpace.reference(kSpace1);
+	}
+	else {
+
+		const ComplexFloatMatrix kSpace1 = pfile->KSpaceData<float>(slice, echo, channel, pass);
+		kSpace.reference(kSpace1);
+	}
+
+	if ((kSpace.extent(0) != frameSize) || (kSpace.extent(1) != numViews)) {
+
+		debug_printf(DP_DEBUG1, "Raw header dims [%ld %ld] do not match k-space dims [%d %d].\n", frameSize, numViews, kSpace.extent(0), kSpace.extent(1));
+		return false;
+	}
+
+	long dims[2] = { frameSize, numViews };
+	long strs[2];
+	md_calc_strides(2, strs, dims, CFL_SIZE);
+
+	_Complex float* tmp = (_Complex float*)md_alloc(2, dims, CFL_SIZE);
+
+	Read(tmp, strs, pass, slice, echo, channel);
+
+	const _Complex float* ref = (const _Complex float*)kSpace.data();
+
+	float err = 0.;
+	float nrm = 0.;
+
+	for (long i = 0; i < frameSize * numViews; i++) {
+
+		const _Complex float d = tmp[i] - ref[i];
+
+		err += sqrtf(__real__ d * __real__ d + __imag__ d * __imag__ d);
+		nrm += sqrtf(__real__ ref[i] * __real__ ref[i] + __imag__ ref[i] * __imag__ ref[i]);
+	}
+
+	md_free(tmp);
+
+	return err <= 1.E-6 * nrm;
+}
@@ -0,0 +1,110 @@
+/* Copyright 2017. The Regents of the University of California.
+ * Copyright 2011-2017 General Electric Company. All rights reserved.
+ * GE Proprietary and Confidential Information. Only to be distributed with
+ * permission from GE. Resulting outputs are not for diagnostic purposes.
+ */
+
+#pragma once
+
+#include <boost/filesystem.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+
+
+namespace GERecon
+{
+	namespace Legacy
+	{
+		class Pfile;
+		typedef boost::shared_ptr<Pfile> PfilePointer;
+	}
+
+
+	namespace BartIO
+	{
+
+		/**
+		 * Memory-mapped view of the raw data region of a Pfile.
+		 *
+		 * The location of every readout block is computed once from the raw
+		 * header, so a block of views can be converted to complex float with a
+		 * single pass over the mapped file. Layout of the raw data region:
+		 *
+		 *   [Pass][Channel][Slice][Echo][Baseline + Views][Read][Re/Im]
+		 *
+		 * Only Pfile revisions that store the data offset in the raw header are
+		 * supported. Use IsValid() before reading.
+		 */
+		class PfileRawData : private boost::noncopyable
+		{
+		public:
+
+			PfileRawData(const boost::filesystem::path& pfilePath, const Legacy::PfilePointer& pfile, const float pfileVersion);
+
+			~PfileRawData();
+
+			/**
+			 * True if the file is mapped and the header describes a supported layout
+			 */
+			bool IsValid() const;
+
+			long ReadoutSize() const { return frameSize; }
+
+			long ViewCount() const { return numViews; }
+
+			/**
+			 * Size in bytes of the raw views of one block, excluding the baseline
+			 */
+			long BlockBytes() const { return numViews * viewBytes; }
+
+			/**
+			 * Pointer to the first (non-baseline) view of a block in the mapped file
+			 */
+			const char* BlockPointer(const int pass, const int slice, const int echo, const int channel) const;
+
+			/**
+			 * Convert all views of a block to complex float.
+			 *
+			 * @param ostrs output strides (bytes) for [Read, Views]
+			 */
+			void Read(_Complex float* out, const long ostrs[2], const int pass, const int slice, const int echo, const int channel) const;
+
+			/**
+			 * Copy the raw views of a block (BlockBytes()) from the mapped file
+			 */
+			void Copy(char* out, const int pass, const int slice, const int echo, const int channel) const;
+
+			/**
+			 * Convert raw views of a block, as returned by Copy(), to complex float.
+			 *
+			 * @param ostrs output strides (bytes) for [Read, Views]
+			 */
+			void Convert(_Complex float* out, const long ostrs[2], const char* in) const;
+
+			/**
+			 * Compare a block against Pfile::KSpaceData. Guards against
+			 * header layouts that differ from the one assumed here.
+			 */
+			bool Verify(const Legacy::PfilePointer& pfile, const int pass, const int slice, const int echo, const int channel) const;
+
+		private:
+
+			int fd;
+			size_t mapSize;
+			const char* base;
+
+			long dataOffset;
+			long pointSize;
+			long frameSize;
+			long numViews;
+			long numSlices;
+			long numEchoes;
+			long numChannels;
+			long numPasses;
+
+			long viewBytes;
+			long blockBytes;
+			long passBytes;
+		};
+	}
+}
@@ -0,0 +1,113 @@
+/* Copyright 2017. The Regents of the University of California.
+ * Copyright 2011-2017 General Electric Company. All rights reserved.
+ * GE Proprietary and Confidential Information. Only to be distributed with
+ * permission from GE. Resulting outputs are not for diagnostic purposes.
+ */
+
+#include <omp.h>
+
+#include <assert.h>
+
+#include "ReconEngine.h"
+
+
+using namespace GERecon;
+
+
+BartIO::ReconEngine::ReconEngine(const Control::ProcessingControlPointer& processingControl, const long acqDims[3], const long zipDims[3], const int imageXRes, const int imageYRes)
+	: processingControl(processingControl), imageXRes(imageXRes), imageYRes(imageYRes)
+{
+	for (int i = 0; i < 3; i++) {
+
+		this->acqDims[i] = acqDims[i];
+		this->zipDims[i] = zipDims[i];
+	}
+}
+
+
+Cartesian3D::ZTransformer& BartIO::ReconEngine::ZTransformer()
+{
+	if (!zTransformer)
+		zTransformer.reset(new Cartesian3D::ZTransformer(*processingControl));
+
+	return *zTransformer;
+}
+
+
+Cartesian2D::KSpaceTransformer& BartIO::ReconEngine::KSpaceTransformer()
+{
+	if (!transformer)
+		transformer.reset(new Cartesian2D::KSpaceTransformer(*processingControl));
+
+	return *transformer;
+}
+
+
+GradwarpPlugin& BartIO::ReconEngine::Gradwarp()
+{
+	if (!gradwarp)
+		gradwarp.reset(new GradwarpPlugin(*processingControl, TwoDGradwarp, XRMBGradient));
+
+	return *gradwarp;
+}
+
+
+MDArray::ComplexFloatCube& BartIO::ReconEngine::AcqKSpaceVol()
+{
+	if (0 == acqKSpaceVol.size())
+		acqKSpaceVol.resize(acqDims[0], acqDims[1], acqDims[2]);
+
+	return acqKSpaceVol;
+}
+
+
+MDArray::ComplexFloatCube& BartIO::ReconEngine::ZipKSpaceVol()
+{
+	if (0 == zipKSpaceVol.size())
+		zipKSpaceVol.resize(zipDims[0], zipDims[1], zipDims[2]);
+
+	return zipKSpaceVol;
+}
+
+
+MDArray::ComplexFloatMatrix& BartIO::ReconEngine::KSpace0()
+{
+	if (0 == kSpace0.size())
+		kSpace0.resize(zipDims[0], zipDims[1]);
+
+	return kSpace0;
+}
+
+
+MDArray::ComplexFloatMatrix& BartIO::ReconEngine::ImageData()
+{
+	if (0 == imageData.size())
+		imageData.resize(imageXRes, imageYRes);
+
+	return imageData;
+}
+
+
+BartIO::ReconEnginePool::ReconEnginePool(const Control::ProcessingControlPointer& processingControl, const long acqDims[3], const long zipDims[3], const int imageXRes, const int imageYRes)
+	: processingControl(processingControl), imageXRes(imageXRes), imageYRes(imageYRes), engines(omp_get_max_threads())
+{
+	for (int i = 0; i < 3; i++) {
+
+		this->acqDims[i] = acqDims[i];
+		this->zipDims[i] = zipDims[i];
+	}
+}
+
+
+BartIO::ReconEngine& BartIO::ReconEnginePool::Local()
+{
+	const int thread = omp_get_thread_num();
+
+	assert(thread < (int)engines.size());
+
+	// every thread only touches its own slot
+	if (!engines[thread])
+		engines[thread].reset(new ReconEngine(processingControl, acqDims, zipDims, imageXRes, imageYRes));
+
+	return *engines[thread];
+}
@@ -0,0 +1,105 @@
+/* Copyright 2017. The Regents of the University of California.
+ * Copyright 2011-2017 General Electric Company. All rights reserved.
+ * GE Proprietary and Confidential Information. Only to be distributed with
+ * permission from GE. Resulting outputs are not for diagnostic purposes.
+ */
+
+#pragma once
+
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include <MDArray/MDArray.h>
+
+#include <Orchestra/Cartesian2D/KSpaceTransformer.h>
+#include <Orchestra/Cartesian3D/ZTransformer.h>
+#include <Orchestra/Control/ProcessingControl.h>
+#include <Orchestra/Gradwarp/GradwarpPlugin.h>
+
+
+namespace GERecon
+{
+	namespace BartIO
+	{
+
+		/**
+		 * Transformers and buffers used by one thread of the Dicom recon.
+		 * Constructing a transformer plans its FFTs, so engines are kept for
+		 * all iterations of a thread instead of being built per image. Each
+		 * part is created on first use, so a recon that only zips pays for
+		 * no k-space transformer, gradwarp or image buffer.
+		 */
+		class ReconEngine : private boost::noncopyable
+		{
+		public:
+
+			/**
+			 * @param acqDims acquired [Read, Phs1, Phs2]
+			 * @param zipDims zipped [Read, Phs1, Phs2]
+			 */
+			ReconEngine(const Control::ProcessingControlPointer& processingControl, const long acqDims[3], const long zipDims[3], const int imageXRes, const int imageYRes);
+
+			Cartesian3D::ZTransformer& ZTransformer();
+			Cartesian2D::KSpaceTransformer& KSpaceTransformer();
+			GradwarpPlugin& Gradwarp();
+
+			/**
+			 * Buffers: [Read, Phs1, Phs2] acquired and zipped volumes, a
+			 * zipped [Read, Phs1] slice and an [ImageXRes, ImageYRes] image
+			 */
+			MDArray::ComplexFloatCube& AcqKSpaceVol();
+			MDArray::ComplexFloatCube& ZipKSpaceVol();
+			MDArray::ComplexFloatMatrix& KSpace0();
+			MDArray::ComplexFloatMatrix& ImageData();
+
+		private:
+
+			const Control::ProcessingControlPointer processingControl;
+
+			long acqDims[3];
+			long zipDims[3];
+
+			const int imageXRes;
+			const int imageYRes;
+
+			boost::shared_ptr<Cartesian3D::ZTransformer> zTransformer;
+			boost::shared_ptr<Cartesian2D::KSpaceTransformer> transformer;
+			boost::shared_ptr<GradwarpPlugin> gradwarp;
+
+			MDArray::ComplexFloatCube acqKSpaceVol;
+			MDArray::ComplexFloatCube zipKSpaceVol;
+			MDArray::ComplexFloatMatrix kSpace0;
+			MDArray::ComplexFloatMatrix imageData;
+		};
+
+
+		/**
+		 * One ReconEngine per OpenMP thread, created on first use
+		 */
+		class ReconEnginePool : private boost::noncopyable
+		{
+		public:
+
+			ReconEnginePool(const Control::ProcessingControlPointer& processingControl, const long acqDims[3], const long zipDims[3], const int imageXRes, const int imageYRes);
+
+			/**
+			 * Engine of the calling thread
+			 */
+			ReconEngine& Local();
+
+		private:
+
+			const Control::ProcessingControlPointer processingControl;
+
+			long acqDims[3];
+			long zipDims[3];
+
+			const int imageXRes;
+			const int imageYRes;
+
+			std::vector<boost::shared_ptr<ReconEngine> > engines;
+		};
+	}
+}
@@ -0,0 +1,131 @@
+/* Copyright 2017. The Regents of the University of California.
+ * Copyright 2011-2017 General Electric Company. All rights reserved.
+ * GE Proprietary and Confidential Information. Only to be distributed with
+ * permission from GE. Resulting outputs are not for diagnostic purposes.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "misc/debug.h"
+
+#include "ScanArchiveIndex.h"
+
+
+using namespace GERecon;
+
+
+static const char indexMagic[8] = { 'O', 'X', 'B', 'A', 'R', 'T', 'I', 'X' };
+static const uint32_t indexVersion = 1;
+
+
+/*
+ * Identifies the archive the index belongs to
+ */
+struct IndexHeader
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t entrySize;
+	uint64_t archiveSize;
+	int64_t archiveTime;
+	uint64_t numControls;
+};
+
+
+static void IndexHeaderInit(IndexHeader& header, const boost::filesystem::path& archivePath)
+{
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, indexMagic, sizeof(indexMagic));
+
+	header.version = indexVersion;
+	header.entrySize = sizeof(BartIO::ScanArchiveIndex::Entry);
+	header.archiveSize = boost::filesystem::file_size(archivePath);
+	header.archiveTime = boost::filesystem::last_write_time(archivePath);
+}
+
+
+boost::filesystem::path BartIO::ScanArchiveIndex::IndexPath(const boost::filesystem::path& archivePath)
+{
+	return archivePath.string() + ".idx";
+}
+
+
+bool BartIO::ScanArchiveIndex::Load(const boost::filesystem::path& archivePath)
+{
+	entries.clear();
+
+	const boost::filesystem::path indexPath = IndexPath(archivePath);
+
+	if (!boost::filesystem::exists(indexPath))
+		return false;
+
+	FILE* fp = fopen(indexPath.string().c_str(), "rb");
+
+	if (NULL == fp)
+		return false;
+
+	IndexHeader expected;
+	IndexHeaderInit(expected, archivePath);
+
+	IndexHeader header;
+
+	bool ok = (1 == fread(&header, sizeof(header), 1, fp))
+		&& (0 == memcmp(header.magic, expected.magic, sizeof(header.magic)))
+		&& (header.version == expected.version)
+		&& (header.entrySize == expected.entrySize)
+		&& (header.archiveSize == expected.archiveSize)
+		&& (header.archiveTime == expected.archiveTime);
+
+	if (ok) {
+
+		entries.resize(header.numControls);
+		ok = (header.numControls == fread(entries.data(), sizeof(Entry), header.numControls, fp));
+	}
+
+	fclose(fp);
+
+	if (!ok) {
+
+		debug_printf(DP_DEBUG1, "Ignoring stale index %s\n", indexPath.string().c_str());
+		entries.clear();
+	}
+
+	return ok;
+}
+
+
+bool BartIO::ScanArchiveIndex::Save(const boost::filesystem::path& archivePath) const
+{
+	const boost::filesystem::path indexPath = IndexPath(archivePath);
+	const boost::filesystem::path tmpPath = indexPath.string() + ".tmp";
+
+	IndexHeader header;
+	IndexHeaderInit(header, archivePath);
+	header.numControls = entries.size();
+
+	FILE* fp = fopen(tmpPath.string().c_str(), "wb");
+
+	if (NULL == fp) {
+
+		debug_printf(DP_WARN, "Could not write index %s\n", indexPath.string().c_str());
+		return false;
+	}
+
+	bool ok = (1 == fwrite(&header, sizeof(header), 1, fp))
+		&& (entries.size() == fwrite(entries.data(), sizeof(Entry), entries.size(), fp));
+
+	ok = (0 == fclose(fp)) && ok;
+
+	// replace atomically, so concurrent readers never see a partial index
+	if (ok)
+		ok = (0 == rename(tmpPath.string().c_str(), indexPath.string().c_str()));
+
+	if (!ok) {
+
+		debug_printf(DP_WARN, "Could not write index %s\n", indexPath.string().c_str());
+		remove(tmpPath.string().c_str());
+	}
+
+	return ok;
+}
@@ -0,0 +1,66 @@
+/* Copyright 2017. The Regents of the University of California.
+ * Copyright 2011-2017 General Electric Company. All rights reserved.
+ * GE Proprietary and Confidential Information. Only to be distributed with
+ * permission from GE. Resulting outputs are not for diagnostic purposes.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include <vector>
+
+#include <boost/filesystem.hpp>
+
+
+namespace GERecon
+{
+	namespace BartIO
+	{
+
+		/**
+		 * Index of the control packets of a ScanArchive, stored next to the
+		 * archive as <archive>.idx. Lists for every control packet its opcode
+		 * and, for frames, the packet view, slice and echo numbers, so later
+		 * extractions know where every frame goes without decoding packets.
+		 *
+		 * The archive storage is read sequentially, so the location of a frame
+		 * is its control packet number.
+		 */
+		class ScanArchiveIndex
+		{
+		public:
+
+			struct Entry
+			{
+				uint32_t control;
+				int32_t opcode;
+
+				// packet values. -1 for packets that are not frames
+				int32_t view;
+				int32_t slice;
+				int32_t echo;
+			};
+
+			static boost::filesystem::path IndexPath(const boost::filesystem::path& archivePath);
+
+			/**
+			 * Load the index of an archive. Fails if there is none or if the
+			 * archive has changed since the index was written.
+			 */
+			bool Load(const boost::filesystem::path& archivePath);
+
+			bool Save(const boost::filesystem::path& archivePath) const;
+
+			void Add(const Entry& entry) { entries.push_back(entry); }
+
+			size_t ControlCount() const { return entries.size(); }
+
+			const Entry& operator[](const size_t control) const { return entries[control]; }
+
+		private:
+
+			std::vector<Entry> entries;
+		};
+	}
+}
@@ -0,0 +1,143 @@
+/* Copyright 2017. The Regents of the University of California.
+ * Copyright 2011-2017 General Electric Company. All rights reserved.
+ * GE Proprietary and Confidential Information. Only to be distributed with
+ * permission from GE. Resulting outputs are not for diagnostic purposes.
+ */
+
+#include <algorithm>
+#include <vector>
+
+#include <math.h>
+#include <string.h>
+
+#include <omp.h>
+
+#include "TransposeKernels.h"
+
+
+using namespace GERecon;
+
+
+/*
+ * Tiles of planes read and written together stay within the L1 cache,
+ * chunks of a single plane within the L2 cache
+ */
+static const long TileBytes = 32 * 1024;
+static const long ChunkBytes = 256 * 1024;
+
+
+static long ChunkSize(const long plane)
+{
+	return std::min(plane, (long)(ChunkBytes / sizeof(_Complex float)));
+}
+
+
+void BartIO::TransposePlanes(const long plane, const long rows, const long cols, const long count, _Complex float* out, const _Complex float* in)
+{
+	const long planeBytes = plane * sizeof(_Complex float);
+
+	const long chunk = ChunkSize(plane);
+	const long numChunks = (plane + chunk - 1) / chunk;
+
+	// a tile of tile x tile planes is read and written once
+	const long tile = std::max(1L, (long)sqrt((double)TileBytes / (2 * planeBytes)));
+
+	const long rowTiles = (rows + tile - 1) / tile;
+	const long colTiles = (cols + tile - 1) / tile;
+
+	const long numTasks = count * rowTiles * colTiles * numChunks;
+
+#pragma omp parallel for
+	for (long task = 0; task < numTasks; task++) {
+
+		long t = task;
+
+		const long ch = t % numChunks;
+		t /= numChunks;
+		const long ct = t % colTiles;
+		t /= colTiles;
+		const long rt = t % rowTiles;
+		const long k = t / rowTiles;
+
+		const long offset = ch * chunk;
+		const long len = std::min(chunk, plane - offset);
+
+		const _Complex float* src = in + k * rows * cols * plane + offset;
+		_Complex float* dst = out + k * rows * cols * plane + offset;
+
+		const long rend = std::min(rows, (rt + 1) * tile);
+		const long cend = std::min(cols, (ct + 1) * tile);
+
+		// sequential writes
+		for (long r = rt * tile; r < rend; r++)
+			for (long c = ct * tile; c < cend; c++)
+				memcpy(dst + (c + r * cols) * plane, src + (r + c * rows) * plane, len * sizeof(_Complex float));
+	}
+}
+
+
+void BartIO::TransposePlanesInPlace(const long plane, const long rows, const long cols, const long count, _Complex float* data)
+{
+	if ((1 == rows) || (1 == cols))
+		return;
+
+	const long n = rows * cols;
+
+	// plane at position j of the output: plane (j / cols, j % cols) of the input
+	struct Source
+	{
+		long rows;
+		long cols;
+
+		long operator()(const long j) const { return (j / cols) + (j % cols) * rows; }
+
+	} source = { rows, cols };
+
+	std::vector<long> leaders;
+	std::vector<bool> visited(n, false);
+
+	for (long s = 0; s < n; s++) {
+
+		if (visited[s])
+			continue;
+
+		long length = 0;
+
+		for (long j = s; !visited[j]; j = source(j), length++)
+			visited[j] = true;
+
+		if (length > 1)
+			leaders.push_back(s);
+	}
+
+	const long chunk = ChunkSize(plane);
+	const long numChunks = (plane + chunk - 1) / chunk;
+
+	const long numTasks = count * numChunks;
+
+#pragma omp parallel
+	{
+		std::vector<_Complex float> tmp(chunk);
+
+#pragma omp for
+		for (long task = 0; task < numTasks; task++) {
+
+			const long offset = (task % numChunks) * chunk;
+			const long bytes = std::min(chunk, plane - offset) * sizeof(_Complex float);
+
+			_Complex float* base = data + (task / numChunks) * n * plane + offset;
+
+			for (std::vector<long>::const_iterator s = leaders.begin(); s != leaders.end(); ++s) {
+
+				memcpy(tmp.data(), base + *s * plane, bytes);
+
+				long j = *s;
+
+				for (long i = source(j); i != *s; j = i, i = source(j))
+					memcpy(base + j * plane, base + i * plane, bytes);
+
+				memcpy(base + j * plane, tmp.data(), bytes);
+			}
+		}
+	}
+}
@@ -0,0 +1,39 @@
+/* Copyright 2017. The Regents of the University of California.
+ * Copyright 2011-2017 General Electric Company. All rights reserved.
+ * GE Proprietary and Confidential Information. Only to be distributed with
+ * permission from GE. Resulting outputs are not for diagnostic purposes.
+ */
+
+#pragma once
+
+
+namespace GERecon
+{
+	namespace BartIO
+	{
+
+		/**
+		 * Swap two adjacent dimensions of an array of contiguous planes:
+		 *
+		 * in:  [plane, rows, cols, count]
+		 * out: [plane, cols, rows, count]
+		 *
+		 * This is the TE <-> Coil permutation between the Pfile and the bart
+		 * mri convention, with plane = Read * Phs1 * Phs2 and count = Phase.
+		 * Planes are copied whole when they are large. Small planes are
+		 * copied in tiles of rows x cols that fit in the L1 cache, and large
+		 * ones are split into chunks so that all threads get work.
+		 *
+		 * @param plane number of complex values in a plane
+		 */
+		void TransposePlanes(const long plane, const long rows, const long cols, const long count, _Complex float* out, const _Complex float* in);
+
+
+		/**
+		 * In-place variant of TransposePlanes. The planes are moved along the
+		 * cycles of the permutation, one chunk of every plane at a time, so
+		 * only a chunk per thread of scratch memory is needed.
+		 */
+		void TransposePlanesInPlace(const long plane, const long rows, const long cols, const long count, _Complex float* data);
+	}
+}
@@ -49,6 +49,8 @@
 #include "CommandLine.h"
 #include "Driver.h"
 #include "BartIO.h"
+#include "ExamCache.h"
+#include "FusedFFT.h"
 
 
 
@@ -60,7 +62,7 @@ using namespace MDArray;
 /**
  * Write Pfile data to BART-formatted file
  */
-void GERecon::BartToDicom()
+void GERecon::BartToDicomTool::BartToDicom()
 {
 	GERecon::TracePointer trace = GERecon::Trace::Instance();
 
@@ -78,7 +80,8 @@ void GERecon::BartToDicom()
 
 	// Read Pfile from command line
 	const boost::filesystem::path pfilePath = CommandLine::PfilePath();
-	const Legacy::PfilePointer pfile = Legacy::Pfile::Create(pfilePath, Legacy::Pfile::AllAvailableAcquisitions, AnonymizationPolicy(AnonymizationPolicy::None));
+	const Legacy::PfilePointer pfile = BartIO::OpenPfile(pfilePath);
+	const Control::ProcessingControlPointer processingControl = BartIO::PfileProcessingControl(pfilePath);
 
 	// get current version of Pfile
 	const Legacy::PfileReader pfileReader(pfilePath);
@@ -101,23 +104,20 @@ void GERecon::BartToDicom()
 		weights = load_cfl(ChannelWeightsString->c_str(), DIMS, cdims);
 
 
-	if (0 != fftmod_flags) {
-
+	if (0 != fftmod_flags)
 		trace->ConsoleMsg("bart fftmod %d", fftmod_flags);
-		fftmod(PFILE_DIMS, dims, fftmod_flags, data, data);
-	}
-
-	if (0 != ifft_flags) {
 
+	if (0 != ifft_flags)
 		trace->ConsoleMsg("bart fft -iu %d", ifft_flags);
-		ifftuc(PFILE_DIMS, dims, ifft_flags, data, data);
-	}
 
-	if (0 != fft_flags) {
-		
+	if (0 != fft_flags)
 		trace->ConsoleMsg("bart fft -u %d", fft_flags);
-		fftuc(PFILE_DIMS, dims, fft_flags, data, data);
-	}
+
+	// fftmod, fft -iu and fft -u in one pass per block
+	long strs[PFILE_DIMS];
+	md_calc_strides(PFILE_DIMS, strs, dims, CFL_SIZE);
+
+	BartIO::FusedFFTApply(PFILE_DIMS, dims, strs, data, fftmod_flags, ifft_flags, fft_flags);
 
 
 	std::string fileName = "Image";
@@ -125,7 +125,10 @@ void GERecon::BartToDicom()
 		fileName = fileNamePrefix->c_str();
 
 	// write to dicom
-	BartIO::BartToDicom(dims, fileName, seriesNumber, seriesDescription, dicomNetwork, data, pfile, pfileVersion, weights);
+	if (*CommandLine::Image())
+		BartIO::BartImageToDicom(dims, fileName, seriesNumber, seriesDescription, dicomNetwork, data, pfile, processingControl, *CommandLine::ImageScale(), *CommandLine::MultiFrame());
+	else
+		BartIO::BartToDicom(dims, fileName, seriesNumber, seriesDescription, dicomNetwork, data, pfile, processingControl, pfileVersion, weights, *CommandLine::MultiFrame());
 
 	if (NULL != weights)
 		unmap_cfl(DIMS, cdims, weights);
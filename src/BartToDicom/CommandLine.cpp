@@ -17,6 +17,7 @@
 #include <Orchestra/Common/ReconException.h>
 
 using namespace GERecon;
+using namespace GERecon::BartToDicomTool;
 
 boost::filesystem::path CommandLine::PfilePath()
 {
@@ -72,6 +73,51 @@ boost::optional<std::string> CommandLine::BartInput()
 }
 
 
+// Option for multi-frame output
+boost::optional<std::string> CommandLine::MultiFrame()
+{
+    boost::program_options::options_description options;
+
+    options.add_options()
+        ("multiframe", boost::program_options::value<std::string>()->default_value("none"), "Pack images into multi-frame objects: none, series or volume. Not with a Dicom network");
+
+    const GESystem::ProgramOptions programOptions;
+    programOptions.AddOptions(options);
+
+    return programOptions.Get<std::string>("multiframe");
+}
+
+
+// Option for image input
+boost::optional<unsigned int> CommandLine::Image()
+{
+    boost::program_options::options_description options;
+
+    options.add_options()
+        ("image", boost::program_options::value<unsigned int>()->default_value(0), "Input is coil-combined images");
+
+    const GESystem::ProgramOptions programOptions;
+    programOptions.AddOptions(options);
+
+    return programOptions.Get<unsigned int>("image");
+}
+
+
+// Option for scaling images
+boost::optional<float> CommandLine::ImageScale()
+{
+    boost::program_options::options_description options;
+
+    options.add_options()
+        ("scale", boost::program_options::value<float>()->default_value(1.), "Scale image magnitude in image mode");
+
+    const GESystem::ProgramOptions programOptions;
+    programOptions.AddOptions(options);
+
+    return programOptions.Get<float>("scale");
+}
+
+
 // Create option for channel weights
 boost::optional<std::string> CommandLine::ChannelWeights()
 {
@@ -20,6 +20,8 @@ namespace GEDicom
 }
 
 namespace GERecon
+{
+namespace BartToDicomTool
 {
     /**
      * Class that contains utilties for parsing parameters/values/flags from
@@ -119,6 +121,32 @@ namespace GERecon
          */
         static boost::optional<std::string> FileNamePrefix();
 
+        /**
+         * Pack images into Enhanced MR multi-frame objects: none, series
+         * (one object) or volume (one object per echo and phase). Objects
+         * are only written to file, so this cannot be combined with a network
+         *
+         * Usage:
+         *   --multiframe <grouping>
+         */
+        static boost::optional<std::string> MultiFrame();
+
+        /**
+         * Input is coil-combined images instead of k-space
+         *
+         * Usage:
+         *   --image 1
+         */
+        static boost::optional<unsigned int> Image();
+
+        /**
+         * Scaling of the image magnitude in image mode
+         *
+         * Usage:
+         *   --scale <scale>
+         */
+        static boost::optional<float> ImageScale();
+
         /**
          * Get a DICOM network from parameters passed on the command line. If all
          * parameters are not set or the network cannot be create an empty pointer
@@ -142,3 +170,4 @@ namespace GERecon
         CommandLine();
     };
 }
+}
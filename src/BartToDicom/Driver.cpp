@@ -19,6 +19,7 @@ extern "C" {
 }
 
 using namespace GERecon;
+using namespace GERecon::BartToDicomTool;
 
 static void print_usage(const char* arg)
 {
@@ -29,6 +30,9 @@ static void print_usage(const char* arg)
 	std::cout << "--ifft flags performs an IFFT on the data along flags" << std::endl;
 	std::cout << "--fftmod flags performs an FFTMod on the data along flags" << std::endl;
 	std::cout << "--weights <weights> inputs custom channel weights" << std::endl;
+	std::cout << "--image 1 <kspace> holds coil-combined images (e.g. from bart pics) at the Dicom image size, no transforms are applied" << std::endl;
+	std::cout << "--scale scale scales the image magnitude in image mode (default: 1)" << std::endl;
+	std::cout << "--multiframe grouping pack images into Enhanced MR multi-frame objects: none, series or volume (per echo and phase), not with a Dicom network (default: none)" << std::endl;
 }
 
     
@@ -39,9 +39,12 @@ namespace GERecon
 		typedef boost::shared_ptr<Pfile> PfilePointer;
 	}
 
+namespace BartToDicomTool
+{
 	/**
 	 * Write a Bart file to dicoms
 	 */
 	void BartToDicom();
+}
 
 }
@@ -6,6 +6,13 @@
  * 2018 Jon Tamir <jtamir@eecs.berkeley.edu>
  */
 
+#include <algorithm>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <stdio.h>
+
 // orchestra includes
 #include <Hdf5/File.h>
 #include <Orchestra/Legacy/Pfile.h>
@@ -30,6 +37,8 @@
 #include "num/flpmath.h"
 
 #include "BartIO.h"
+#include "ExamCache.h"
+#include "CalibrationCache.h"
 
 // project includes
 #include "CommandLine.h"
@@ -43,24 +52,70 @@ using namespace MDArray;
 using namespace GEHdf5;
 
 
+/*
+ * Parse matrix sizes "XxYxZ,XxYxZ,..."
+ */
+static std::vector<std::vector<long> > ParseSizes(const std::string& sizes)
+{
+	std::vector<std::vector<long> > out;
+
+	std::stringstream list(sizes);
+	std::string item;
+
+	while (std::getline(list, item, ',')) {
+
+		std::vector<long> size(3);
+
+		if ((3 != sscanf(item.c_str(), "%ldx%ldx%ld", &size[0], &size[1], &size[2])) || (size[0] < 1) || (size[1] < 1) || (size[2] < 1))
+			error("Invalid matrix size %s, expected XxYxZ!\n", item.c_str());
+
+		out.push_back(size);
+	}
+
+	return out;
+}
+
+
+/*
+ * Write volumes [begin, end) along COIL_DIM of a calibration volume
+ */
+static void WriteVolumes(const std::string& name, const BartIO::CalibrationCache::Volume& volume, const long begin, const long end)
+{
+	long dims[DIMS];
+	md_copy_dims(DIMS, dims, volume.dims);
+	dims[COIL_DIM] = end - begin;
+
+	const long size = md_calc_size(3, dims);
+
+	_Complex float* data = (_Complex float*)create_cfl(name.c_str(), DIMS, dims);
+
+	std::copy(volume.data.begin() + begin * size, volume.data.begin() + end * size, data);
+
+	unmap_cfl(DIMS, dims, data);
+}
+
+
 /**
  * Write RawCalibration data to BART-formatted file
  */
-void GERecon::CalibrationData()
+void GERecon::CalibrationDataTool::CalibrationData()
 {
 	GERecon::Trace trace("CalibrationData");
 
 	// Read cal data file from command line
 	const boost::filesystem::path calDataPath = CommandLine::CalibrationDataPath();
-	const GEHdf5::File calDataFile(calDataPath.string(), GEHdf5::File::ReadOnly);
 
 	// Read Pfile from command line
 	const boost::filesystem::path pfilePath = CommandLine::PfilePath();
-	const Legacy::PfilePointer pfile = Legacy::Pfile::Create(pfilePath, Legacy::Pfile::AllAvailableAcquisitions, AnonymizationPolicy(AnonymizationPolicy::None));
-	Control::ProcessingControlPointer processingControl = pfile->CreateOrchestraProcessingControl();
+	const Legacy::PfilePointer pfile = BartIO::OpenPfile(pfilePath);
+	Control::ProcessingControlPointer processingControl = BartIO::PfileProcessingControl(pfilePath);
 
 	// Get file output names
 	const boost::optional<std::string> bodyCoilVolOutput = CommandLine::BodyCoilVolOutput();
+	const boost::optional<std::string> coilVolOutput = CommandLine::CoilVolOutput();
+
+	if (!bodyCoilVolOutput && !coilVolOutput)
+		error("No output options specified!\n");
 
 	// Get body coil image and reformat to match imaging field of view
 	const int acqXRes = processingControl->Value<int>("AcquiredXRes");
@@ -71,21 +126,66 @@ void GERecon::CalibrationData()
 	const SliceCorners& sliceCornersEnd = pfile->Corners(numSlices - 1);
 	const float scanCenter = processingControl->Value<float>("ScanCenter");
 
+	std::vector<std::vector<long> > sizes(1, std::vector<long>{ acqXRes, acqYRes, acqZRes });
+
+	if (CommandLine::Sizes())
+		sizes = ParseSizes(*CommandLine::Sizes());
+
+	BartIO::CalibrationCache cache(CommandLine::CacheDirectory() ? *CommandLine::CacheDirectory() : std::string());
+
+	// loaded on the first cache miss only, then shared by all sizes. The
+	// SDK interpolation is not known to be reentrant, so sizes are
+	// interpolated one after another
 	GERecon::Calibration::RawFile rawCalibrationFile(*processingControl, GERecon::Calibration::ThreeD);
-	rawCalibrationFile.Load(calDataPath, GERecon::CalibrationFile::ForceLoad);
-	GERecon::Calibration::CalibrationData calibrationImageData = rawCalibrationFile.ImageSpaceData(GERecon::Calibration::VolumeImageSpace, acqXRes, acqYRes, acqZRes, sliceCornersStart, sliceCornersEnd, scanCenter);
+	bool loaded = false;
+
+	for (long i = 0; i < (long)sizes.size(); i++) {
+
+		const long* size = sizes[i].data();
+
+		const std::string key = BartIO::CalibrationCache::Key(calDataPath, GERecon::Calibration::VolumeImageSpace, size, sliceCornersStart, sliceCornersEnd, scanCenter);
+
+		const BartIO::CalibrationCache::VolumePointer volume = cache.Get(key, [&]() {
+
+			if (!loaded) {
+
+				rawCalibrationFile.Load(calDataPath, GERecon::CalibrationFile::ForceLoad);
+				loaded = true;
+			}
+
+			const GERecon::Calibration::CalibrationData calibrationImageData = rawCalibrationFile.ImageSpaceData(GERecon::Calibration::VolumeImageSpace, size[0], size[1], size[2], sliceCornersStart, sliceCornersEnd, scanCenter);
+
+			boost::shared_ptr<BartIO::CalibrationCache::Volume> vol(new BartIO::CalibrationCache::Volume);
+
+			// body coil volume first, followed by the coil array volumes
+			md_singleton_dims(DIMS, vol->dims);
+			vol->dims[READ_DIM] = size[0];
+			vol->dims[PHS1_DIM] = size[1];
+			vol->dims[PHS2_DIM] = size[2];
+			vol->dims[COIL_DIM] = calibrationImageData.size() / md_calc_size(3, vol->dims);
+
+			const _Complex float* data = (const _Complex float*)calibrationImageData.data();
+			vol->data.assign(data, data + md_calc_size(DIMS, vol->dims));
+
+			return BartIO::CalibrationCache::VolumePointer(vol);
+		});
+
+		const long numVolumes = volume->dims[COIL_DIM];
+
+		char suffix[64] = "";
 
-	long body_coil_dims[DIMS];
-	md_singleton_dims(DIMS, body_coil_dims);
-	body_coil_dims[READ_DIM] = acqXRes;
-	body_coil_dims[PHS1_DIM] = acqYRes;
-	body_coil_dims[PHS2_DIM] = acqZRes;
+		if (sizes.size() > 1)
+			snprintf(suffix, sizeof(suffix), "_%ldx%ldx%ld", size[0], size[1], size[2]);
 
-	long flat_dims[1] = { md_calc_size(DIMS, body_coil_dims) };
+		if (bodyCoilVolOutput)
+			WriteVolumes(*bodyCoilVolOutput + suffix, *volume, 0, 1);
 
-	_Complex float* cal_data = (_Complex float*)create_cfl(bodyCoilVolOutput->c_str(), DIMS, body_coil_dims);
+		if (coilVolOutput) {
 
-	md_copy(1, flat_dims, cal_data, calibrationImageData.data(), CFL_SIZE);
+			if (numVolumes < 2)
+				error("Calibration file has no coil array volumes!\n");
 
-	unmap_cfl(DIMS, body_coil_dims, cal_data);
+			WriteVolumes(*coilVolOutput + suffix, *volume, 1, numVolumes);
+		}
+	}
 }
@@ -15,6 +15,7 @@
 #include <Orchestra/Common/ReconException.h>
 
 using namespace GERecon;
+using namespace GERecon::CalibrationDataTool;
 
 boost::filesystem::path CommandLine::PfilePath()
 {
@@ -88,13 +89,50 @@ boost::optional<std::string> CommandLine::BodyCoilVolOutput()
     const GESystem::ProgramOptions programOptions;
     programOptions.AddOptions(options);
 
-    // Check if the command line has a "--body" option
-    const boost::optional<std::string> outputOption = programOptions.Get<std::string>("body");
+    return programOptions.Get<std::string>("body");
+}
 
-    if(!outputOption)
-    {
-        throw GERecon::Exception(__SOURCE__, "No output body coil BART file specified! Use '--body' on command line.");
-    }
 
-    return programOptions.Get<std::string>("body");
+// Create option for output coil array file name
+boost::optional<std::string> CommandLine::CoilVolOutput()
+{
+    boost::program_options::options_description options;
+
+    options.add_options()
+        ("coils", boost::program_options::value<std::string>(), "Output coil array volumes (BART format)");
+
+    const GESystem::ProgramOptions programOptions;
+    programOptions.AddOptions(options);
+
+    return programOptions.Get<std::string>("coils");
+}
+
+
+// Option for the matrix sizes of the outputs
+boost::optional<std::string> CommandLine::Sizes()
+{
+    boost::program_options::options_description options;
+
+    options.add_options()
+        ("sizes", boost::program_options::value<std::string>(), "Matrix sizes of the outputs (XxYxZ,...)");
+
+    const GESystem::ProgramOptions programOptions;
+    programOptions.AddOptions(options);
+
+    return programOptions.Get<std::string>("sizes");
+}
+
+
+// Option for the calibration cache directory
+boost::optional<std::string> CommandLine::CacheDirectory()
+{
+    boost::program_options::options_description options;
+
+    options.add_options()
+        ("cache", boost::program_options::value<std::string>(), "Directory caching volumes by geometry");
+
+    const GESystem::ProgramOptions programOptions;
+    programOptions.AddOptions(options);
+
+    return programOptions.Get<std::string>("cache");
 }
@@ -14,6 +14,8 @@
 
 
 namespace GERecon
+{
+namespace CalibrationDataTool
 {
     /**
      * Class that contains utilties for parsing parameters/values/flags from
@@ -63,6 +65,34 @@ namespace GERecon
          */
         static boost::optional<std::string> BodyCoilVolOutput();
 
+
+        /**
+         * Output coil array volumes in BART format
+         *
+         * Usage:
+         *   --coils <file>
+         */
+        static boost::optional<std::string> CoilVolOutput();
+
+
+        /**
+         * Matrix sizes of the outputs. With several sizes, each output is
+         * written as <file>_<X>x<Y>x<Z>. Default: acquisition size
+         *
+         * Usage:
+         *   --sizes <X>x<Y>x<Z>[,<X>x<Y>x<Z>...]
+         */
+        static boost::optional<std::string> Sizes();
+
+
+        /**
+         * Directory caching interpolated volumes by geometry
+         *
+         * Usage:
+         *   --cache <directory>
+         */
+        static boost::optional<std::string> CacheDirectory();
+
     private:
 
         /**
@@ -71,3 +101,4 @@ namespace GERecon
         CommandLine();
     };
 }
+}
@@ -19,11 +19,15 @@ extern "C" {
 }
 
 using namespace GERecon;
+using namespace GERecon::CalibrationDataTool;
 
 static void print_usage(const char* arg)
 {
-	std::cout << "Usage: " << arg << "--input <RawCalibration> [--pfile <pfile>] [--body <body_image>]" << std::endl << std::endl;
+	std::cout << "Usage: " << arg << "--input <RawCalibration> [--pfile <pfile>] [--body <body_image>] [--coils <coil_images>]" << std::endl << std::endl;
 	std::cout << "Write body coil pre-scan h5 data into BART-formatted files." << std::endl;
+	std::cout << "Specify one or more outputs." << std::endl;
+	std::cout << "--sizes XxYxZ,... write each output at these matrix sizes, as <file>_XxYxZ if more than one" << std::endl;
+	std::cout << "--cache <dir> reuse volumes of the same geometry from <dir>" << std::endl;
 }
 
     
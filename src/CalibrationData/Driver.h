@@ -32,9 +32,12 @@
  * @author Matt Bingen
  */
 namespace GERecon
+{
+namespace CalibrationDataTool
 {
     /**
      * Write Noise data to BART formatted file
      */
     void CalibrationData();
 }
+}
@@ -15,6 +15,7 @@
 #include <Orchestra/Common/ReconException.h>
 
 using namespace GERecon;
+using namespace GERecon::NoiseCovTool;
 
 boost::filesystem::path CommandLine::NoiseDataPath()
 {
@@ -90,3 +91,33 @@ boost::optional<std::string> CommandLine::OptimalMatrixOutput()
 
     return programOptions.Get<std::string>("optmat");
 }
+
+
+// Create option for output whitening matrix file name
+boost::optional<std::string> CommandLine::WhiteningOutput()
+{
+    boost::program_options::options_description options;
+
+    options.add_options()
+        ("whiten", boost::program_options::value<std::string>(), "Output noise whitening matrix (BART format)");
+
+    const GESystem::ProgramOptions programOptions;
+    programOptions.AddOptions(options);
+
+    return programOptions.Get<std::string>("whiten");
+}
+
+
+// Option for computing the covariance from the noise samples
+boost::optional<unsigned int> CommandLine::ComputeFromNoise()
+{
+    boost::program_options::options_description options;
+
+    options.add_options()
+        ("compute", boost::program_options::value<unsigned int>()->default_value(0), "Compute covariance from noise samples");
+
+    const GESystem::ProgramOptions programOptions;
+    programOptions.AddOptions(options);
+
+    return programOptions.Get<unsigned int>("compute");
+}
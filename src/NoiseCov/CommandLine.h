@@ -14,6 +14,8 @@
 
 
 namespace GERecon
+{
+namespace NoiseCovTool
 {
     /**
      * Class that contains utilties for parsing parameters/values/flags from
@@ -71,6 +73,26 @@ namespace GERecon
          */
         static boost::optional<std::string> OptimalMatrixOutput();
 
+
+        /**
+         * Output noise whitening matrix (inverse Cholesky factor of the
+         * covariance) in BART format, computed from the noise samples
+         *
+         * Usage:
+         *   --whiten <file>
+         */
+        static boost::optional<std::string> WhiteningOutput();
+
+
+        /**
+         * Compute the covariance from the noise samples instead of reading
+         * the Covariance dataset
+         *
+         * Usage:
+         *   --compute 1
+         */
+        static boost::optional<unsigned int> ComputeFromNoise();
+
     private:
 
         /**
@@ -79,3 +101,4 @@ namespace GERecon
         CommandLine();
     };
 }
+}
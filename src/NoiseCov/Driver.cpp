@@ -19,12 +19,15 @@ extern "C" {
 }
 
 using namespace GERecon;
+using namespace GERecon::NoiseCovTool;
 
 static void print_usage(const char* arg)
 {
-	std::cout << "Usage: " << arg << "--input <NoiseStatistics> [--covar <covar>] [--noise <noise>] [--optmat <optmat>]" << std::endl << std::endl;
+	std::cout << "Usage: " << arg << "--input <NoiseStatistics> [--covar <covar>] [--noise <noise>] [--optmat <optmat>] [--whiten <whiten>] [--compute 1]" << std::endl << std::endl;
 	std::cout << "Write <NoiseStatistics> h5 data into BART-formatted files." << std::endl;
 	std::cout << "Specify one or more outputs." << std::endl;
+	std::cout << "--whiten writes the whitening matrix computed from the noise samples." << std::endl;
+	std::cout << "--compute 1 computes the covariance from the noise samples as well." << std::endl;
 }
 
     
@@ -32,9 +32,12 @@
  * @author Matt Bingen
  */
 namespace GERecon
+{
+namespace NoiseCovTool
 {
     /**
      * Write Noise data to BART formatted file
      */
     void NoiseData();
 }
+}
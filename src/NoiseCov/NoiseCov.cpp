@@ -6,8 +6,10 @@
  * 2017 Jon Tamir <jtamir@eecs.berkeley.edu>
  */
 
+#include <algorithm>
+#include <vector>
+
 // orchestra includes
-#include <Hdf5/File.h>
 #include <Orchestra/Legacy/Pfile.h>
 #include <Orchestra/Legacy/PfileReader.h>
 #include <Orchestra/Legacy/SliceEntry.h>
@@ -28,6 +30,8 @@
 #include "num/flpmath.h"
 
 #include "BartIO.h"
+#include "Hdf5Dataset.h"
+#include "NoiseWhitening.h"
 
 // project includes
 #include "CommandLine.h"
@@ -38,48 +42,109 @@
 // Include this to avoid having to type fully qualified names
 using namespace GERecon;
 using namespace MDArray;
-using namespace GEHdf5;
+
+
+/*
+ * Datasets are read and written in hyperslabs of at most this size
+ */
+static const long ChunkBytes = 16 * 1024 * 1024;
+
+
+/**
+ * Write a [Coil, Coil] matrix to BART-formatted file
+ */
+static void WriteChannelMatrix(const std::string& name, const long numChannels, const _Complex float* mat)
+{
+	long dims[DIMS];
+	md_singleton_dims(DIMS, dims);
+	dims[COIL_DIM] = numChannels;
+	dims[MAPS_DIM] = numChannels;
+
+	_Complex float* data = (_Complex float*)create_cfl(name.c_str(), DIMS, dims);
+
+	md_copy(DIMS, dims, data, mat, CFL_SIZE);
+
+	unmap_cfl(DIMS, dims, data);
+}
+
+
+/**
+ * Write a [Row][Col] matrix dataset to a BART-formatted [Coil, Maps] file.
+ * Element (i, j) goes to coil i and map j, so each chunk of rows is
+ * transposed while it is copied.
+ */
+static void WriteMatrixDataset(const std::string& name, const std::string& fileName, const std::string& dataset)
+{
+	const BartIO::Hdf5Dataset matrix(fileName, "Data", dataset);
+
+	const long rows = matrix.Rows();
+	const long cols = matrix.Cols();
+
+	long dims[DIMS];
+	md_singleton_dims(DIMS, dims);
+	dims[COIL_DIM] = rows;
+	dims[MAPS_DIM] = cols;
+
+	_Complex float* data = (_Complex float*)create_cfl(name.c_str(), DIMS, dims);
+
+	const long chunk = matrix.ChunkRows(ChunkBytes);
+	std::vector<_Complex float> buffer(chunk * cols);
+
+	for (long r0 = 0; r0 < rows; r0 += chunk) {
+
+		const long nr = std::min(chunk, rows - r0);
+
+		matrix.Read(r0, nr, 0, cols, buffer.data());
+
+		for (long j = 0; j < cols; j++)
+			for (long r = 0; r < nr; r++)
+				data[(r0 + r) + rows * j] = buffer[r * cols + j];
+	}
+
+	unmap_cfl(DIMS, dims, data);
+}
 
 
 /**
  * Write Pfile data to BART-formatted file
  */
-void GERecon::NoiseData()
+void GERecon::NoiseCovTool::NoiseData()
 {
 	GERecon::Trace trace("NoiseData");
 
 	// Read Noise data file from command line
 	const boost::filesystem::path noiseDataPath = CommandLine::NoiseDataPath();
-
-	const GEHdf5::File noiseDataFile(noiseDataPath.string(), GEHdf5::File::ReadOnly);
+	const std::string noiseDataFile = noiseDataPath.string();
 
 	// Get file output names
 	const boost::optional<std::string> covarOutput = CommandLine::CovarOutput();
 	const boost::optional<std::string> noiseDataOutput = CommandLine::NoiseDataOutput();
 	const boost::optional<std::string> optimalMatrixOutput = CommandLine::OptimalMatrixOutput();
+	const boost::optional<std::string> whiteningOutput = CommandLine::WhiteningOutput();
+
+	const bool computeFromNoise = (0 != *CommandLine::ComputeFromNoise());
 
 	int output_count = 0;
 
-	if (covarOutput) {
+	boost::shared_ptr<BartIO::NoiseCovariance> noiseCov;
+
+	if ((covarOutput && computeFromNoise) || whiteningOutput)
+		noiseCov = BartIO::ReadNoiseCovariance(noiseDataFile, ChunkBytes);
 
-		const GEHdf5::Dims covDims = noiseDataFile.Dimensions("Data", "Covariance");
-		ComplexFloatMatrix covData(covDims[0], covDims[1]);
-		noiseDataFile.Read(covData, "Data", "Covariance");
+	if (covarOutput && computeFromNoise) {
 
-		long cov_dims[DIMS];
-		md_singleton_dims(DIMS, cov_dims);
-		cov_dims[COIL_DIM] = covDims[0];
-		cov_dims[MAPS_DIM] = covDims[1];
+		const long C = noiseCov->ChannelCount();
 
-		long cov_flat_dims[2];
-		cov_flat_dims[0] = covDims[0];
-		cov_flat_dims[1] = covDims[1];
+		std::vector<_Complex float> cov(C * C);
+		noiseCov->Covariance(cov.data());
 
-		_Complex float* cov_data = (_Complex float*)create_cfl(covarOutput->c_str(), DIMS, cov_dims);
+		WriteChannelMatrix(*covarOutput, C, cov.data());
 
-		md_transpose(2, 0, 1, cov_flat_dims, cov_data, cov_flat_dims, covData.data(), CFL_SIZE);
+		output_count++;
 
-		unmap_cfl(DIMS, cov_dims, cov_data);
+	} else if (covarOutput) {
+
+		WriteMatrixDataset(*covarOutput, noiseDataFile, "Covariance");
 
 		output_count++;
 	}
@@ -87,25 +152,21 @@ void GERecon::NoiseData()
 
 	if (noiseDataOutput) {
 
-		const GEHdf5::Dims noiseDims = noiseDataFile.Dimensions("Data", "NoiseData");
-		ComplexDoubleMatrix noiseDataD(noiseDims[0], noiseDims[1]);
-		noiseDataFile.Read(noiseDataD, "Data", "NoiseData");
-
-		ComplexFloatMatrix noiseData(noiseDims[1], noiseDims[0]);
-		noiseData = MDArray::cast<std::complex<float> >(noiseDataD);
+		// [Channel][Samples] is the bart layout [Samples, Coil]: chunks of
+		// channels are read straight into the output, converted to float
+		const BartIO::Hdf5Dataset noiseData(noiseDataFile, "Data", "NoiseData");
 
 		long noise_dims[DIMS];
 		md_singleton_dims(DIMS, noise_dims);
-		noise_dims[READ_DIM] = noiseDims[1];
-		noise_dims[COIL_DIM] = noiseDims[0];
-
-		long noise_flat_dims[2];
-		noise_flat_dims[0] = noise_dims[READ_DIM];
-		noise_flat_dims[1] = noise_dims[COIL_DIM];
+		noise_dims[READ_DIM] = noiseData.Cols();
+		noise_dims[COIL_DIM] = noiseData.Rows();
 
 		_Complex float* noise_data = (_Complex float*)create_cfl(noiseDataOutput->c_str(), DIMS, noise_dims);
 
-		md_copy(2, noise_flat_dims, noise_data, (_Complex float*)noiseData.data(), CFL_SIZE);
+		const long chunk = noiseData.ChunkRows(ChunkBytes);
+
+		for (long c = 0; c < noiseData.Rows(); c += chunk)
+			noiseData.Read(c, std::min(chunk, noiseData.Rows() - c), 0, noiseData.Cols(), noise_data + c * noiseData.Cols());
 
 		unmap_cfl(DIMS, noise_dims, noise_data);
 
@@ -115,24 +176,20 @@ void GERecon::NoiseData()
 
 	if (optimalMatrixOutput) {
 
-		const GEHdf5::Dims optDims = noiseDataFile.Dimensions("Data", "OptimalTransformation");
-		ComplexFloatMatrix optData(optDims[0], optDims[1]);
-		noiseDataFile.Read(optData, "Data", "OptimalTransformation");
+		WriteMatrixDataset(*optimalMatrixOutput, noiseDataFile, "OptimalTransformation");
+
+		output_count++;
+	}
 
-		long opt_dims[DIMS];
-		md_singleton_dims(DIMS, opt_dims);
-		opt_dims[COIL_DIM] = optDims[0];
-		opt_dims[MAPS_DIM] = optDims[1];
 
-		long opt_flat_dims[2];
-		opt_flat_dims[0] = optDims[0];
-		opt_flat_dims[1] = optDims[1];
+	if (whiteningOutput) {
 
-		_Complex float* opt_data = (_Complex float*)create_cfl(optimalMatrixOutput->c_str(), DIMS, opt_dims);
+		const long C = noiseCov->ChannelCount();
 
-		md_transpose(2, 0, 1, opt_flat_dims, opt_data, opt_flat_dims, optData.data(), CFL_SIZE);
+		std::vector<_Complex float> whiten(C * C);
+		noiseCov->Whitening(whiten.data());
 
-		unmap_cfl(DIMS, opt_dims, opt_data);
+		WriteChannelMatrix(*whiteningOutput, C, whiten.data());
 
 		output_count++;
 	}
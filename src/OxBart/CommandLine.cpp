@@ -0,0 +1,98 @@
+/* Copyright 2018. The Regents of the University of California.
+ * Copyright 2011-2018 General Electric Company. All rights reserved.
+ * GE Proprietary and Confidential Information. Only to be distributed with
+ * permission from GE. Resulting outputs are not for diagnostic purposes.
+ */
+
+#include <boost/program_options.hpp>
+
+#include <System/Utilities/ProgramOptions.h>
+
+#include "CommandLine.h"
+
+using namespace GERecon;
+using namespace GERecon::OxBartTool;
+
+
+boost::optional<std::string> CommandLine::Spool()
+{
+    boost::program_options::options_description options;
+
+    options.add_options()
+        ("serve", boost::program_options::value<std::string>(), "Spool directory of the server");
+
+    const GESystem::ProgramOptions programOptions;
+    programOptions.AddOptions(options);
+
+    return programOptions.Get<std::string>("serve");
+}
+
+
+boost::optional<int> CommandLine::Jobs()
+{
+    boost::program_options::options_description options;
+
+    options.add_options()
+        ("jobs", boost::program_options::value<int>()->default_value(2), "Number of jobs running at the same time");
+
+    const GESystem::ProgramOptions programOptions;
+    programOptions.AddOptions(options);
+
+    return programOptions.Get<int>("jobs");
+}
+
+
+boost::optional<int> CommandLine::Threads()
+{
+    boost::program_options::options_description options;
+
+    options.add_options()
+        ("threads", boost::program_options::value<int>()->default_value(0), "Number of threads shared by the running jobs");
+
+    const GESystem::ProgramOptions programOptions;
+    programOptions.AddOptions(options);
+
+    return programOptions.Get<int>("threads");
+}
+
+
+boost::optional<long> CommandLine::Memory()
+{
+    boost::program_options::options_description options;
+
+    options.add_options()
+        ("memory", boost::program_options::value<long>()->default_value(0), "Memory budget of the running jobs in MiB");
+
+    const GESystem::ProgramOptions programOptions;
+    programOptions.AddOptions(options);
+
+    return programOptions.Get<long>("memory");
+}
+
+
+boost::optional<int> CommandLine::Exams()
+{
+    boost::program_options::options_description options;
+
+    options.add_options()
+        ("exams", boost::program_options::value<int>()->default_value(4), "Number of exams kept open between jobs");
+
+    const GESystem::ProgramOptions programOptions;
+    programOptions.AddOptions(options);
+
+    return programOptions.Get<int>("exams");
+}
+
+
+boost::optional<int> CommandLine::Command()
+{
+    boost::program_options::options_description options;
+
+    options.add_options()
+        ("command", boost::program_options::value<int>(), "Number of the command in a chained run");
+
+    const GESystem::ProgramOptions programOptions;
+    programOptions.AddOptions(options);
+
+    return programOptions.Get<int>("command");
+}
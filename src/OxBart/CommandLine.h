@@ -0,0 +1,84 @@
+/* Copyright 2018. The Regents of the University of California.
+ * Copyright 2011-2018 General Electric Company. All rights reserved.
+ * GE Proprietary and Confidential Information. Only to be distributed with
+ * permission from GE. Resulting outputs are not for diagnostic purposes.
+ */
+
+#pragma once
+
+#include <string>
+
+#include <boost/filesystem.hpp>
+#include <boost/optional.hpp>
+
+
+namespace GERecon
+{
+namespace OxBartTool
+{
+    /**
+     * Options of the ox-bart server mode. The options of the commands
+     * are read by the CommandLine class of each tool.
+     */
+    class CommandLine
+    {
+    public:
+
+        /**
+         * Spool directory to take jobs from. Runs ox-bart as a server.
+         *
+         * Usage:
+         *   --serve <directory>
+         */
+        static boost::optional<std::string> Spool();
+
+        /**
+         * Number of jobs running at the same time
+         *
+         * Usage:
+         *   --jobs <jobs>
+         */
+        static boost::optional<int> Jobs();
+
+        /**
+         * Number of threads shared by the running jobs. 0: all processors
+         *
+         * Usage:
+         *   --threads <threads>
+         */
+        static boost::optional<int> Threads();
+
+        /**
+         * Memory budget of the running jobs in MiB. 0: no budget
+         *
+         * Usage:
+         *   --memory <MiB>
+         */
+        static boost::optional<long> Memory();
+
+        /**
+         * Number of exams kept open between jobs
+         *
+         * Usage:
+         *   --exams <exams>
+         */
+        static boost::optional<int> Exams();
+
+        /**
+         * Number of the command in a chained run. Set by ox-bart on the
+         * command line of each command, to check that it is the current one.
+         *
+         * Usage:
+         *   --command <number>
+         */
+        static boost::optional<int> Command();
+
+    private:
+
+        /**
+         * Constructor - do not allow.
+         */
+        CommandLine();
+    };
+}
+}
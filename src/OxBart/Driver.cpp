@@ -0,0 +1,207 @@
+/* Copyright 2018. The Regents of the University of California.
+ * Copyright 2011-2018 General Electric Company. All rights reserved.
+ * GE Proprietary and Confidential Information. Only to be distributed with
+ * permission from GE. Resulting outputs are not for diagnostic purposes.
+ */
+
+
+#include <iostream>
+#include <exception>
+#include <string>
+#include <vector>
+
+#include <string.h>
+
+#include <System/Utilities/ProgramOptions.h>
+
+#include "../PfileToBart/Driver.h"
+#include "../ScanArchiveToBart/Driver.h"
+#include "../BartToDicom/Driver.h"
+#include "../NoiseCov/Driver.h"
+#include "../CalibrationData/Driver.h"
+
+#include "CommandLine.h"
+#include "Server.h"
+
+extern "C" {
+#include "num/init.h"
+}
+
+using namespace GERecon;
+
+
+struct Subcommand
+{
+	const char* name;
+	void (*run)();
+	const char* usage;
+};
+
+static const Subcommand subcommands[] = {
+
+	{ "PfileToBart", PfileToBartTool::BartWrite, "--pfile <Pfile> --output <kspace>" },
+	{ "ScanArchiveToBart", ScanArchiveToBartTool::BartWrite, "--file <ScanArchive> --output <kspace>" },
+	{ "BartToDicom", BartToDicomTool::BartToDicom, "--pfile <Pfile> --input <image>" },
+	{ "NoiseCov", NoiseCovTool::NoiseData, "--input <NoiseStatistics> [--covar <covar>] ..." },
+	{ "CalibrationData", CalibrationDataTool::CalibrationData, "--input <RawCalibration> --pfile <Pfile> [--body <body>] ..." },
+};
+
+static const int numSubcommands = sizeof(subcommands) / sizeof(subcommands[0]);
+
+
+static const Subcommand* find_subcommand(const char* name)
+{
+	for (int i = 0; i < numSubcommands; i++)
+		if (0 == strcmp(name, subcommands[i].name))
+			return &subcommands[i];
+
+	return NULL;
+}
+
+
+static void print_usage(const char* arg)
+{
+	std::cout << "Usage: " << arg << " [common options] <command> [options] [+ <command> [options]] ..." << std::endl << std::endl;
+	std::cout << "Run one or more tools in a single process, so the SDK starts once and" << std::endl;
+	std::cout << "the Pfile and processing control of an exam are opened once for all commands." << std::endl;
+	std::cout << "Common options, e.g. --pfile <Pfile>, are passed to every command." << std::endl;
+	std::cout << "Commands are separated by '+' and take the options of the tool of the same name:" << std::endl << std::endl;
+
+	for (int i = 0; i < numSubcommands; i++)
+		std::cout << "  " << subcommands[i].name << " " << subcommands[i].usage << std::endl;
+
+	std::cout << std::endl;
+	std::cout << "Usage: " << arg << " --serve <spool> [--jobs n] [--threads n] [--memory MiB] [--exams n]" << std::endl << std::endl;
+	std::cout << "Run as a server on the jobs in directory <spool>. A job <name>.job lists the" << std::endl;
+	std::cout << "arguments of an ox-bart run, one per line. It is renamed to <name>.run, then" << std::endl;
+	std::cout << "to <name>.done or <name>.failed, with its output in <name>.log. Jobs inherit" << std::endl;
+	std::cout << "the opened exam (Pfile and processing control) from the server; engines and" << std::endl;
+	std::cout << "FFT plans are set up by each job." << std::endl;
+	std::cout << "--jobs n run up to n jobs at the same time (default: 2)" << std::endl;
+	std::cout << "--threads n threads shared by the running jobs (default: all processors)" << std::endl;
+	std::cout << "--memory MiB start no job that would exceed this estimated memory (default: no budget)" << std::endl;
+	std::cout << "--exams n keep the last n exams open between jobs (default: 4)" << std::endl;
+}
+
+
+/*
+ * Run the commands of an ox-bart command line in turn
+ */
+static int run_commands(const int argc, const char* const argv[])
+{
+    // common options go up to the first command
+    int first = 1;
+
+    while ((first < argc) && (NULL == find_subcommand(argv[first])))
+        first++;
+
+    if (first == argc)
+    {
+        print_usage(argv[0]);
+        return -1;
+    }
+
+    int arg = first;
+    int number = 0;
+
+    while (arg < argc)
+    {
+        const Subcommand* subcommand = find_subcommand(argv[arg]);
+
+        if (NULL == subcommand)
+        {
+            std::cout << "Unknown command " << argv[arg] << "!" << std::endl;
+            print_usage(argv[0]);
+            return -1;
+        }
+
+        const std::string name = std::string(argv[0]) + " " + subcommand->name;
+
+        std::vector<const char*> args(1, name.c_str());
+        args.insert(args.end(), argv + 1, argv + first);
+
+        for (arg++; (arg < argc) && (0 != strcmp(argv[arg], "+")); arg++)
+            args.push_back(argv[arg]);
+
+        // skip the separator
+        arg++;
+
+        // The SDK holds one command line per process. Each command is
+        // numbered, so options left from an earlier command are detected.
+        const std::string numberArg = std::to_string(++number);
+
+        args.push_back("--command");
+        args.push_back(numberArg.c_str());
+
+        try
+        {
+            GESystem::ProgramOptions().SetupCommandLine(args.size(), args.data());
+
+            if (number != OxBartTool::CommandLine::Command().get_value_or(0))
+            {
+                std::cout << "Cannot set up the command line of " << subcommand->name << "!" << std::endl;
+                return -1;
+            }
+
+            subcommand->run();
+        }
+        catch( std::exception& e )
+        {
+            std::cout << "Runtime Exception in " << subcommand->name << "! " << e.what() << std::endl;
+            print_usage(argv[0]);
+            return -1;
+        }
+        catch( ... )
+        {
+            std::cout << "Unknown Runtime Exception in " << subcommand->name << "!" << std::endl;
+            print_usage(argv[0]);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+
+/*
+ * Run a job of the server
+ */
+static int run_job(const OxBartTool::JobArguments& jobArgs)
+{
+    std::vector<const char*> args(1, "ox-bart");
+
+    for (size_t i = 0; i < jobArgs.size(); i++)
+        args.push_back(jobArgs[i].c_str());
+
+    return run_commands(args.size(), args.data());
+}
+
+
+/*****************************************************************
+ ** Main function that runs the pipeline of each command in turn **
+ ******************************************************************/
+int main(const int argc, const char* const argv[])
+{
+    // initialize BART
+    num_init();
+
+    for (int i = 1; i < argc; i++)
+        if (NULL != find_subcommand(argv[i]))
+            return run_commands(argc, argv);
+
+    GESystem::ProgramOptions().SetupCommandLine(argc, argv);
+
+    try
+    {
+        if (OxBartTool::CommandLine::Spool())
+            return OxBartTool::Serve(run_job);
+    }
+    catch( std::exception& e )
+    {
+        std::cout << "Runtime Exception! " << e.what() << std::endl;
+    }
+
+    print_usage(argv[0]);
+
+    return -1;
+}
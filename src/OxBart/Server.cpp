@@ -0,0 +1,429 @@
+/* Copyright 2018. The Regents of the University of California.
+ * Copyright 2011-2018 General Electric Company. All rights reserved.
+ * GE Proprietary and Confidential Information. Only to be distributed with
+ * permission from GE. Resulting outputs are not for diagnostic purposes.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <omp.h>
+
+#include <boost/filesystem.hpp>
+
+#include <Orchestra/Legacy/Pfile.h>
+
+// includes for bart
+#include "misc/misc.h"
+#include "misc/debug.h"
+
+#include "ExamCache.h"
+
+#include "CommandLine.h"
+#include "Server.h"
+
+
+using namespace GERecon;
+using namespace GERecon::OxBartTool;
+
+
+/*
+ * Interval between two scans of the spool directory
+ */
+static const useconds_t PollInterval = 100000;
+
+/*
+ * Line of a .run file naming the server process that runs the job
+ */
+static const char OwnerPrefix[] = "#owner ";
+
+static volatile sig_atomic_t stopping = 0;
+
+
+static void Stop(int)
+{
+	stopping = 1;
+}
+
+
+struct Job
+{
+	std::string name;
+	JobArguments args;
+
+	// canonical Pfile path, empty without --pfile
+	std::string exam;
+
+	// estimate in bytes
+	long memory;
+};
+
+
+static boost::filesystem::path JobFile(const boost::filesystem::path& spool, const std::string& name, const char* state)
+{
+	return spool / (name + state);
+}
+
+
+/*
+ * Move a job to another state. Fails when another server took the job first.
+ */
+static bool MoveJob(const boost::filesystem::path& spool, const std::string& name, const char* from, const char* to)
+{
+	boost::system::error_code ec;
+	boost::filesystem::rename(JobFile(spool, name, from), JobFile(spool, name, to), ec);
+
+	return !ec;
+}
+
+
+/*
+ * Record the server owning a running job in its .run file
+ */
+static void SetOwner(const boost::filesystem::path& spool, const std::string& name)
+{
+	std::ofstream out(JobFile(spool, name, ".run").string().c_str(), std::ios::app);
+
+	out << std::endl << OwnerPrefix << getpid() << std::endl;
+}
+
+
+/*
+ * A running job is stale when the server owning it is gone, or when it has
+ * no owner because its server stopped before recording itself
+ */
+static bool IsStale(const boost::filesystem::path& file)
+{
+	std::ifstream in(file.string().c_str());
+
+	pid_t owner = 0;
+	std::string line;
+
+	while (std::getline(in, line))
+		if (0 == line.compare(0, strlen(OwnerPrefix), OwnerPrefix))
+			owner = atoi(line.c_str() + strlen(OwnerPrefix));
+
+	return (owner <= 0) || ((0 != kill(owner, 0)) && (ESRCH == errno));
+}
+
+
+static bool Contains(const JobArguments& args, const char* arg)
+{
+	return args.end() != std::find(args.begin(), args.end(), arg);
+}
+
+
+/*
+ * Arguments, exam and memory estimate of a job file. The estimate is
+ * twice the size of the input files: the input and the converted output.
+ */
+static bool ReadJob(const boost::filesystem::path& file, Job& job)
+{
+	std::ifstream in(file.string().c_str());
+
+	if (!in)
+		return false;
+
+	job.name = file.stem().string();
+	job.args.clear();
+	job.exam.clear();
+	job.memory = 0;
+
+	std::string line;
+
+	while (std::getline(in, line)) {
+
+		if (!line.empty() && ('\r' == line[line.size() - 1]))
+			line.erase(line.size() - 1);
+
+		if (!line.empty())
+			job.args.push_back(line);
+	}
+
+	boost::system::error_code ec;
+
+	for (size_t i = 0; i < job.args.size(); i++) {
+
+		if (boost::filesystem::is_regular_file(job.args[i], ec))
+			job.memory += 2 * boost::filesystem::file_size(job.args[i], ec);
+
+		if (("--pfile" == job.args[i]) && (i + 1 < job.args.size())) {
+
+			const boost::filesystem::path pfilePath = boost::filesystem::canonical(job.args[i + 1], ec);
+
+			if (!ec)
+				job.exam = pfilePath.string();
+		}
+	}
+
+	return !job.args.empty();
+}
+
+
+/*
+ * Jobs waiting in the spool directory, oldest first
+ */
+static std::vector<boost::filesystem::path> PendingJobs(const boost::filesystem::path& spool)
+{
+	std::vector<std::pair<std::time_t, boost::filesystem::path> > jobs;
+
+	boost::system::error_code ec;
+
+	for (boost::filesystem::directory_iterator it(spool, ec), end; !ec && (it != end); it.increment(ec)) {
+
+		const boost::filesystem::path& file = it->path();
+
+		if (".job" != file.extension())
+			continue;
+
+		const std::time_t time = boost::filesystem::last_write_time(file, ec);
+
+		if (!ec)
+			jobs.push_back(std::make_pair(time, file));
+
+		ec.clear();
+	}
+
+	std::sort(jobs.begin(), jobs.end());
+
+	std::vector<boost::filesystem::path> files;
+
+	for (size_t i = 0; i < jobs.size(); i++)
+		files.push_back(jobs[i].second);
+
+	return files;
+}
+
+
+/*
+ * Open the exam of a job in the server, so this and later jobs on the
+ * exam inherit it. Only the Pfile and processing control are cached;
+ * engines, transformers and FFT plans depend on the command and are set up
+ * by each job. Errors are left to the job, which reports them.
+ */
+static void WarmExam(const Job& job)
+{
+	if (job.exam.empty())
+		return;
+
+	try {
+
+		const Legacy::PfilePointer pfile = BartIO::OpenPfile(job.exam);
+
+		if (Contains(job.args, "PfileToBart"))
+			BartIO::PfileProcessingControl(job.exam, !pfile->IsZEncoded());
+
+		if (Contains(job.args, "BartToDicom") || Contains(job.args, "CalibrationData"))
+			BartIO::PfileProcessingControl(job.exam);
+
+	} catch (std::exception& e) {
+
+		debug_printf(DP_WARN, "Cannot open exam of job %s: %s\n", job.name.c_str(), e.what());
+
+	} catch (...) {
+
+		debug_printf(DP_WARN, "Cannot open exam of job %s\n", job.name.c_str());
+	}
+}
+
+
+/*
+ * Body of the forked job process
+ */
+static int RunJob(const boost::filesystem::path& spool, const Job& job, const int threads, JobFunction run)
+{
+	signal(SIGINT, SIG_DFL);
+	signal(SIGTERM, SIG_DFL);
+
+	const int log = open(JobFile(spool, job.name, ".log").string().c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+	if (log >= 0) {
+
+		dup2(log, STDOUT_FILENO);
+		dup2(log, STDERR_FILENO);
+		close(log);
+	}
+
+	omp_set_num_threads(threads);
+
+	const int status = run(job.args);
+
+	std::cout.flush();
+	fflush(NULL);
+
+	return status;
+}
+
+
+int OxBartTool::Serve(JobFunction run)
+{
+	const boost::filesystem::path spool = *CommandLine::Spool();
+	const int maxJobs = std::max(1, *CommandLine::Jobs());
+	const long budget = *CommandLine::Memory() * 1024 * 1024;
+	const int exams = *CommandLine::Exams();
+
+	// the server itself never runs parallel regions, and forks only while
+	// no exam is being opened, so forking it is safe
+	int threads = *CommandLine::Threads();
+
+	if (threads <= 0)
+		threads = omp_get_num_procs();
+
+	const int jobThreads = std::max(1, threads / maxJobs);
+
+	boost::filesystem::create_directories(spool);
+
+	// jobs of a server that was killed. Jobs of other servers on the spool are left alone
+	std::vector<std::string> stale;
+
+	for (boost::filesystem::directory_iterator it(spool), end; it != end; ++it)
+		if ((".run" == it->path().extension()) && IsStale(it->path()))
+			stale.push_back(it->path().stem().string());
+
+	for (size_t i = 0; i < stale.size(); i++)
+		MoveJob(spool, stale[i], ".run", ".failed");
+
+	signal(SIGINT, Stop);
+	signal(SIGTERM, Stop);
+
+	debug_printf(DP_INFO, "Serving %s: %d jobs of %d threads\n", spool.string().c_str(), maxJobs, jobThreads);
+
+	std::map<pid_t, Job> running;
+	long used = 0;
+
+	// The exam of the next job is opened by a thread, so the loop keeps
+	// reaping jobs meanwhile. The job is forked once the thread is done.
+	std::thread warmer;
+	std::atomic<bool> warming(false);
+
+	Job next;
+	bool hasNext = false;
+
+	auto start = [&](const Job& job) {
+
+		std::cout.flush();
+		fflush(NULL);
+
+		const pid_t pid = fork();
+
+		if (0 == pid)
+			_exit((0 == RunJob(spool, job, jobThreads, run)) ? 0 : 1);
+
+		if (pid < 0) {
+
+			debug_printf(DP_ERROR, "Cannot start job %s\n", job.name.c_str());
+			MoveJob(spool, job.name, ".run", ".failed");
+
+			used -= job.memory;
+			return;
+		}
+
+		debug_printf(DP_INFO, "Job %s started\n", job.name.c_str());
+
+		running[pid] = job;
+	};
+
+	while (!stopping || !running.empty() || hasNext) {
+
+		int status;
+		pid_t pid;
+
+		while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+
+			const std::map<pid_t, Job>::iterator it = running.find(pid);
+
+			if (running.end() == it)
+				continue;
+
+			const bool done = WIFEXITED(status) && (0 == WEXITSTATUS(status));
+
+			MoveJob(spool, it->second.name, ".run", done ? ".done" : ".failed");
+
+			debug_printf(DP_INFO, "Job %s %s\n", it->second.name.c_str(), done ? "done" : "failed");
+
+			used -= it->second.memory;
+			running.erase(it);
+
+			BartIO::CloseExams(exams);
+		}
+
+		if (hasNext && !warming) {
+
+			warmer.join();
+			start(next);
+			hasNext = false;
+		}
+
+		boost::system::error_code ec;
+
+		if (boost::filesystem::remove(spool / "stop", ec))
+			stopping = 1;
+
+		const std::vector<boost::filesystem::path> pending = (stopping || hasNext) ? std::vector<boost::filesystem::path>() : PendingJobs(spool);
+
+		// jobs on the same exam run concurrently; the exam is only read
+		for (size_t i = 0; i < pending.size(); i++) {
+
+			if ((int)running.size() >= maxJobs)
+				break;
+
+			Job job;
+
+			if (!ReadJob(pending[i], job)) {
+
+				MoveJob(spool, pending[i].stem().string(), ".job", ".failed");
+				continue;
+			}
+
+			// a job larger than the budget runs alone; later jobs wait for it
+			if ((budget > 0) && !running.empty() && (used + job.memory > budget))
+				break;
+
+			if (!MoveJob(spool, job.name, ".job", ".run"))
+				continue;
+
+			SetOwner(spool, job.name);
+
+			used += job.memory;
+
+			if (job.exam.empty()) {
+
+				start(job);
+				continue;
+			}
+
+			next = job;
+			hasNext = true;
+			warming = true;
+
+			warmer = std::thread([&]() {
+
+				WarmExam(next);
+				warming = false;
+			});
+
+			break;
+		}
+
+		usleep(PollInterval);
+	}
+
+	return 0;
+}
@@ -0,0 +1,46 @@
+/* Copyright 2018. The Regents of the University of California.
+ * Copyright 2011-2018 General Electric Company. All rights reserved.
+ * GE Proprietary and Confidential Information. Only to be distributed with
+ * permission from GE. Resulting outputs are not for diagnostic purposes.
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+
+namespace GERecon
+{
+	namespace OxBartTool
+	{
+		/**
+		 * Arguments of a job: an ox-bart command line without the program name
+		 */
+		typedef std::vector<std::string> JobArguments;
+
+		typedef int (*JobFunction)(const JobArguments& args);
+
+		/**
+		 * Run jobs from the spool directory of the --serve option until
+		 * SIGINT or SIGTERM, or until a file named "stop" appears in it.
+		 *
+		 * A job is a file <name>.job with one argument per line. Clients
+		 * write it under another name and rename it, so it is complete when
+		 * it appears. The server renames it to <name>.run while it runs and
+		 * to <name>.done or <name>.failed after; its output is in <name>.log.
+		 * A .run file records the server running it. At startup, the jobs of
+		 * servers that are gone are marked failed.
+		 *
+		 * Each job runs in a process forked from the server, so it starts
+		 * with the SDK and BART initialized and the exam (Pfile and
+		 * processing control) already opened. Only the exam is cached:
+		 * recon engines, transformers and FFT plans are set up by each job.
+		 * The server opens the exam of a job in a thread while it keeps
+		 * reaping jobs, and forks the job after. Jobs, also on the same
+		 * exam, run concurrently within the --jobs, --threads and --memory
+		 * budget.
+		 */
+		int Serve(JobFunction run);
+	}
+}
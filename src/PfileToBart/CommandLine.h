@@ -14,6 +14,8 @@
 
 
 namespace GERecon
+{
+namespace PfileToBartTool
 {
     /**
      * Class that contains utilties for parsing parameters/values/flags from
@@ -85,6 +87,79 @@ namespace GERecon
          */
 	static boost::optional<long> FFTMod();
 
+        /**
+         * Number of I/O threads reading the Pfile
+         *
+         * Usage:
+         *   --readers <threads>
+         */
+        static boost::optional<int> Readers();
+
+        /**
+         * Number of virtual coils for coil compression. 0: no compression
+         *
+         * Usage:
+         *   --cc <coils>
+         */
+        static boost::optional<int> VirtualCoils();
+
+        /**
+         * Coil compression type: svd or geometric
+         *
+         * Usage:
+         *   --cc-type <type>
+         */
+        static boost::optional<std::string> CoilCompressionType();
+
+        /**
+         * Size of the calibration region for coil compression
+         *
+         * Usage:
+         *   --cc-calib <size>
+         */
+        static boost::optional<long> CoilCompressionCalib();
+
+        /**
+         * Extract only the selected slices: a:b selects a ... b - 1
+         *
+         * Usage:
+         *   --slices <range>
+         */
+        static boost::optional<std::string> Slices();
+
+        /**
+         * Extract only the selected echoes: a:b selects a ... b - 1
+         *
+         * Usage:
+         *   --echoes <range>
+         */
+        static boost::optional<std::string> Echoes();
+
+        /**
+         * Extract only the selected channels: a:b selects a ... b - 1
+         *
+         * Usage:
+         *   --channels <range>
+         */
+        static boost::optional<std::string> Channels();
+
+        /**
+         * Extract only the selected phases: a:b selects a ... b - 1
+         *
+         * Usage:
+         *   --phases <range>
+         */
+        static boost::optional<std::string> Phases();
+
+        /**
+         * Noise statistics (h5) or bart covariance from NoiseCov for
+         * prewhitening the channels while writing
+         *
+         * Usage:
+         *   --noise <file>
+         */
+        static boost::optional<std::string> Noise();
+
     private:
 
         /**
@@ -93,3 +168,4 @@ namespace GERecon
         CommandLine();
     };
 }
+}
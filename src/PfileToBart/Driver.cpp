@@ -19,6 +19,7 @@ extern "C" {
 }
 
 using namespace GERecon;
+using namespace GERecon::PfileToBartTool;
 
 static void print_usage(const char* arg)
 {
@@ -28,6 +29,15 @@ static void print_usage(const char* arg)
 	std::cout << "--ifft flags performs an IFFT on the data along flags" << std::endl;
 	std::cout << "--fftmod flags performs an FFTMod on the data along flags" << std::endl;
 	std::cout << "--weights <file> output channel weights to <file>" << std::endl;
+	std::cout << "--slices a:b extract only slices a ... b - 1" << std::endl;
+	std::cout << "--echoes a:b extract only echoes a ... b - 1" << std::endl;
+	std::cout << "--channels a:b extract only channels a ... b - 1" << std::endl;
+	std::cout << "--phases a:b extract only phases a ... b - 1" << std::endl;
+	std::cout << "--noise <file> prewhiten channels with <NoiseStatistics> h5 data or a BART covariance from NoiseCov --covar" << std::endl;
+	std::cout << "--cc coils compress channels to <coils> virtual coils while writing" << std::endl;
+	std::cout << "--cc-type type coil compression type: svd or geometric (default: svd)" << std::endl;
+	std::cout << "--cc-calib size size of the coil compression calibration region (default: 24)" << std::endl;
+	std::cout << "--readers threads number of I/O threads reading the Pfile (default: 2)" << std::endl;
 }
 
     
@@ -32,9 +32,12 @@
  * @author Matt Bingen
  */
 namespace GERecon
+{
+namespace PfileToBartTool
 {
     /**
      * Write a Pfile to BART formatted file
      */
     void BartWrite();
 }
+}
@@ -6,6 +6,11 @@
  * 2016-2017 Jon Tamir <jtamir@eecs.berkeley.edu>
  */
 
+#include <algorithm>
+#include <vector>
+
+#include <boost/make_shared.hpp>
+
 // orchestra includes
 #include <Orchestra/Legacy/Pfile.h>
 #include <Orchestra/Legacy/PfileReader.h>
@@ -32,6 +37,9 @@
 #include "num/fft.h"
 
 #include "BartIO.h"
+#include "ExamCache.h"
+#include "CoilCompression.h"
+#include "NoiseWhitening.h"
 
 // project includes
 #include "CommandLine.h"
@@ -47,18 +55,20 @@ using namespace MDArray;
 /**
  * Write Pfile data to BART-formatted file
  */
-void GERecon::BartWrite()
+void GERecon::PfileToBartTool::BartWrite()
 {
 	GERecon::Trace trace("PfiletoBart");
 
 	const long ifft_flags = *CommandLine::IFFT();
 	const long fft_flags = *CommandLine::FFT();
 	const long fftmod_flags = *CommandLine::FFTMod();
+	const int numReaders = *CommandLine::Readers();
+	const int numVirtualCoils = *CommandLine::VirtualCoils();
 
 	// Read Pfile from command line
 	const boost::filesystem::path pfilePath = CommandLine::PfilePath();
 
-	const Legacy::PfilePointer pfile = Legacy::Pfile::Create(pfilePath, Legacy::Pfile::AllAvailableAcquisitions, AnonymizationPolicy(AnonymizationPolicy::None));
+	const Legacy::PfilePointer pfile = BartIO::OpenPfile(pfilePath);
 
 	// get current version of Pfile
 	const Legacy::PfileReader pfileReader(pfilePath);
@@ -74,11 +84,7 @@ void GERecon::BartWrite()
 #endif
 
 	// Get acquired k-space dimensions from processingControl. the pfile dimensions may be zipped
-	Control::ProcessingControlPointer processingControl;
-	if (pfile->IsZEncoded())
-		processingControl = pfile->CreateOrchestraProcessingControl();
-	else
-		processingControl = pfile->CreateOrchestraProcessingControl<Cartesian2D::LxControlSource>();
+	const Control::ProcessingControlPointer processingControl = BartIO::PfileProcessingControl(pfilePath, !pfile->IsZEncoded());
 
 	const int acqXRes = processingControl->Value<int>("AcquiredXRes");
 	const int acqYRes = processingControl->Value<int>("AcquiredYRes");
@@ -128,38 +134,80 @@ void GERecon::BartWrite()
 
 	//debug_print_dims(DP_INFO, PFILE_DIMS, dims);
 
-	// copy into bart-formatted ksp array
-	_Complex float* ksp2 = (_Complex float*)md_alloc(PFILE_DIMS, dims, CFL_SIZE);
+	// flags refer to Pfile dimensions
+	BartIO::IngestOptions options;
+	options.pfilePath = pfilePath;
+	options.numReaders = numReaders;
+	options.fftmod_flags = fftmod_flags;
+	options.ifft_flags = ifft_flags;
+	options.fft_flags = fft_flags;
 
-	BartIO::PfileToBart(dims, ksp2, pfile, pfileVersion);
+	// only the selected blocks are read
+	if (CommandLine::Slices())
+		options.selection.Select(2, *CommandLine::Slices());
 
-	if (0 != fftmod_flags) {
+	if (CommandLine::Echoes())
+		options.selection.Select(3, *CommandLine::Echoes());
 
-		std::cout << "bart fftmod " << fftmod_flags << std::endl;
-		fftmod(PFILE_DIMS, dims, fftmod_flags, ksp2, ksp2);
-	}
+	if (CommandLine::Channels())
+		options.selection.Select(4, *CommandLine::Channels());
 
-	if (0 != ifft_flags) {
+	if (CommandLine::Phases())
+		options.selection.Select(5, *CommandLine::Phases());
 
-		std::cout << "bart fft -iu " << ifft_flags << std::endl;
-		ifftuc(PFILE_DIMS, dims, ifft_flags, ksp2, ksp2);
-	}
+	long sdims[PFILE_DIMS];
+	options.selection.Dims(sdims, dims);
 
-	if (0 != fft_flags) {
-		
-		std::cout << "bart fft -u " << fft_flags << std::endl;
-		fftuc(PFILE_DIMS, dims, fft_flags, ksp2, ksp2);
+	// whitening of the selected channels, applied to each block as it is placed
+	std::vector<_Complex float> whitening;
+
+	if (CommandLine::Noise()) {
+
+		std::cout << "bart whiten" << std::endl;
+		whitening = BartIO::LoadWhitening(*CommandLine::Noise(), numChannels, options.selection);
 	}
 
+	if (numVirtualCoils > 0) {
+
+		const BartIO::CoilCompression::Type ccType = BartIO::CoilCompression::TypeFromString(*CommandLine::CoilCompressionType());
+
+		long caldims[PFILE_DIMS];
+		BartIO::CoilCompression::CalibrationDims(caldims, sdims, ccType, *CommandLine::CoilCompressionCalib());
+
+		_Complex float* cal = (_Complex float*)md_alloc(PFILE_DIMS, caldims, CFL_SIZE);
+		BartIO::PfileToBartCalibration(caldims, cal, dims, pfile, pfileVersion, options);
+
+		std::cout << "bart cc -p " << numVirtualCoils << " " << *CommandLine::CoilCompressionType() << std::endl;
+		options.coils = boost::make_shared<const BartIO::CoilCompression>(ccType, numVirtualCoils, caldims, cal, whitening.empty() ? NULL : whitening.data());
+
+		md_free(cal);
+
+	} else if (!whitening.empty()) {
+
+		// readouts are whitened in place, so blocks are still written directly
+		options.whitening = whitening.data();
+	}
 
 	long odims[DIMS];
-	BartIO::FormatBartMRIDims(odims, dims);
+	BartIO::FormatBartMRIDims(odims, sdims);
+
+	if (options.coils)
+		odims[COIL_DIM] = options.coils->VirtualCount();
 
 	_Complex float* ksp = (_Complex float*)create_cfl(OutString->c_str(), DIMS, odims);
 
-	BartIO::FormatBartMRI(odims, ksp, dims, ksp2);
+	if (0 != fftmod_flags)
+		std::cout << "bart fftmod " << fftmod_flags << std::endl;
+
+	if (0 != ifft_flags)
+		std::cout << "bart fft -iu " << ifft_flags << std::endl;
+
+	if (0 != fft_flags)
+		std::cout << "bart fft -u " << fft_flags << std::endl;
+
+	// scatter readouts straight into the bart-formatted output. No intermediate copy
+	BartIO::PfileToBartMRI(odims, ksp, dims, pfile, pfileVersion, options);
 
-	md_free(ksp2);
 
 	if (ChannelWeightsString) {
 
@@ -168,8 +216,18 @@ void GERecon::BartWrite()
 
 		_Complex float* weights = (_Complex float*)create_cfl(ChannelWeightsString->c_str(), DIMS, cdims);
 
-		for (int currentChannel = 0; currentChannel < numChannels; currentChannel++)
-			weights[currentChannel] = channelWeights(currentChannel);
+		std::vector<_Complex float> cweights(sdims[4]);
+
+		for (int currentChannel = 0; currentChannel < sdims[4]; currentChannel++)
+			cweights[currentChannel] = channelWeights(options.selection.start[4] + currentChannel);
+
+		// weights of the virtual coils when compressing
+		if (options.coils)
+			options.coils->Weights(weights, cweights.data());
+		else if (NULL != options.whitening)
+			BartIO::CoilCompression(sdims[4], options.whitening).Weights(weights, cweights.data());
+		else
+			std::copy(cweights.begin(), cweights.end(), weights);
 
 		unmap_cfl(DIMS, cdims, weights);
 	}
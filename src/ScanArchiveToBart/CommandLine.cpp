@@ -16,6 +16,7 @@
 #include <Orchestra/Common/ReconException.h>
 
 using namespace GERecon;
+using namespace GERecon::ScanArchiveToBartTool;
 
 boost::filesystem::path CommandLine::ScanArchivePath()
 {
@@ -63,6 +64,21 @@ boost::optional<unsigned int> CommandLine::SequentialStorage()
 }
 
 
+// Option for only indexing the ScanArchive
+boost::optional<unsigned int> CommandLine::BuildIndex()
+{
+    boost::program_options::options_description options;
+
+    options.add_options()
+        ("build-index", boost::program_options::value<unsigned int>()->default_value(0), "Only write the packet index of the ScanArchive");
+
+    const GESystem::ProgramOptions programOptions;
+    programOptions.AddOptions(options);
+
+    return programOptions.Get<unsigned int>("build-index");
+}
+
+
 // Create option for output file name
 boost::optional<std::string> CommandLine::Output()
 {
@@ -144,3 +160,138 @@ boost::optional<long> CommandLine::FFTMod()
 
     return programOptions.Get<long>("fftmod");
 }
+
+
+// Option for the number of virtual coils
+boost::optional<int> CommandLine::VirtualCoils()
+{
+    boost::program_options::options_description options;
+
+    options.add_options()
+        ("cc", boost::program_options::value<int>()->default_value(0), "Compress to virtual coils");
+
+    const GESystem::ProgramOptions programOptions;
+    programOptions.AddOptions(options);
+
+    return programOptions.Get<int>("cc");
+}
+
+
+// Option for the coil compression type
+boost::optional<std::string> CommandLine::CoilCompressionType()
+{
+    boost::program_options::options_description options;
+
+    options.add_options()
+        ("cc-type", boost::program_options::value<std::string>()->default_value("svd"), "Coil compression type: svd or geometric");
+
+    const GESystem::ProgramOptions programOptions;
+    programOptions.AddOptions(options);
+
+    return programOptions.Get<std::string>("cc-type");
+}
+
+
+// Option for the coil compression calibration size
+boost::optional<long> CommandLine::CoilCompressionCalib()
+{
+    boost::program_options::options_description options;
+
+    options.add_options()
+        ("cc-calib", boost::program_options::value<long>()->default_value(24), "Size of the coil compression calibration region");
+
+    const GESystem::ProgramOptions programOptions;
+    programOptions.AddOptions(options);
+
+    return programOptions.Get<long>("cc-calib");
+}
+
+
+// Option for selecting slices
+boost::optional<std::string> CommandLine::Slices()
+{
+    boost::program_options::options_description options;
+
+    options.add_options()
+        ("slices", boost::program_options::value<std::string>(), "Extract only the selected slices (a:b)");
+
+    const GESystem::ProgramOptions programOptions;
+    programOptions.AddOptions(options);
+
+    return programOptions.Get<std::string>("slices");
+}
+
+
+// Option for selecting echoes
+boost::optional<std::string> CommandLine::Echoes()
+{
+    boost::program_options::options_description options;
+
+    options.add_options()
+        ("echoes", boost::program_options::value<std::string>(), "Extract only the selected echoes (a:b)");
+
+    const GESystem::ProgramOptions programOptions;
+    programOptions.AddOptions(options);
+
+    return programOptions.Get<std::string>("echoes");
+}
+
+
+// Option for selecting channels
+boost::optional<std::string> CommandLine::Channels()
+{
+    boost::program_options::options_description options;
+
+    options.add_options()
+        ("channels", boost::program_options::value<std::string>(), "Extract only the selected channels (a:b)");
+
+    const GESystem::ProgramOptions programOptions;
+    programOptions.AddOptions(options);
+
+    return programOptions.Get<std::string>("channels");
+}
+
+
+// Option for following a ScanArchive during acquisition
+boost::optional<long> CommandLine::Follow()
+{
+    boost::program_options::options_description options;
+
+    options.add_options()
+        ("follow", boost::program_options::value<long>()->default_value(0), "Follow a growing ScanArchive in blocks of readouts");
+
+    const GESystem::ProgramOptions programOptions;
+    programOptions.AddOptions(options);
+
+    return programOptions.Get<long>("follow");
+}
+
+
+// Option for the idle timeout of follow mode
+boost::optional<double> CommandLine::FollowTimeout()
+{
+    boost::program_options::options_description options;
+
+    options.add_options()
+        ("follow-timeout", boost::program_options::value<double>()->default_value(30.), "Stop following after <seconds> without new packets when the archive has no end of scan packet");
+
+    const GESystem::ProgramOptions programOptions;
+    programOptions.AddOptions(options);
+
+    return programOptions.Get<double>("follow-timeout");
+}
+
+
+// Option for noise prewhitening
+boost::optional<std::string> CommandLine::Noise()
+{
+    boost::program_options::options_description options;
+
+    options.add_options()
+        ("noise", boost::program_options::value<std::string>(), "Prewhiten channels with noise statistics (h5) or covariance (BART)");
+
+    const GESystem::ProgramOptions programOptions;
+    programOptions.AddOptions(options);
+
+    return programOptions.Get<std::string>("noise");
+}
@@ -14,6 +14,8 @@
 
 
 namespace GERecon
+{
+namespace ScanArchiveToBartTool
 {
     /**
      * Class that contains utilties for parsing parameters/values/flags from
@@ -60,6 +62,14 @@ namespace GERecon
          */
 	static boost::optional<unsigned int> SequentialStorage();
 
+        /**
+         * Only write the packet index of the ScanArchive
+         *
+         * Usage:
+         *   --build-index 1
+         */
+        static boost::optional<unsigned int> BuildIndex();
+
         static boost::optional<std::string> Output();
 
         /**
@@ -94,6 +104,82 @@ namespace GERecon
          */
 	static boost::optional<long> FFTMod();
 
+        /**
+         * Number of virtual coils for coil compression. 0: no compression
+         *
+         * Usage:
+         *   --cc <coils>
+         */
+        static boost::optional<int> VirtualCoils();
+
+        /**
+         * Coil compression type: svd or geometric
+         *
+         * Usage:
+         *   --cc-type <type>
+         */
+        static boost::optional<std::string> CoilCompressionType();
+
+        /**
+         * Size of the calibration region for coil compression
+         *
+         * Usage:
+         *   --cc-calib <size>
+         */
+        static boost::optional<long> CoilCompressionCalib();
+
+        /**
+         * Extract only the selected slices: a:b selects a ... b - 1
+         *
+         * Usage:
+         *   --slices <range>
+         */
+        static boost::optional<std::string> Slices();
+
+        /**
+         * Extract only the selected echoes: a:b selects a ... b - 1
+         *
+         * Usage:
+         *   --echoes <range>
+         */
+        static boost::optional<std::string> Echoes();
+
+        /**
+         * Extract only the selected channels: a:b selects a ... b - 1
+         *
+         * Usage:
+         *   --channels <range>
+         */
+        static boost::optional<std::string> Channels();
+
+        /**
+         * Follow a ScanArchive that is being written, in blocks of <readouts>.
+         * 0: read the complete ScanArchive
+         *
+         * Usage:
+         *   --follow <readouts>
+         */
+        static boost::optional<long> Follow();
+
+        /**
+         * Seconds without new packets after which follow mode ends when
+         * the archive has no end of scan packet. The scan control packets
+         * ending a pass do not end follow mode.
+         *
+         * Usage:
+         *   --follow-timeout <seconds>
+         */
+        static boost::optional<double> FollowTimeout();
+
+        /**
+         * Noise statistics (h5) or bart covariance from NoiseCov for
+         * prewhitening the channels while writing
+         *
+         * Usage:
+         *   --noise <file>
+         */
+        static boost::optional<std::string> Noise();
+
     private:
 
         /**
@@ -102,3 +188,4 @@ namespace GERecon
         CommandLine();
     };
 }
+}
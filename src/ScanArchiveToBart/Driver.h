@@ -32,9 +32,12 @@
  * @author Matt Bingen
  */
 namespace GERecon
+{
+namespace ScanArchiveToBartTool
 {
     /**
      * Write a ScanArchive to BART formatted file
      */
     void BartWrite();
 }
+}
@@ -6,6 +6,14 @@
  * 2016-2017 Jon Tamir <jtamir@eecs.berkeley.edu>
  */
 
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <stdio.h>
+
 // orchestra includes
 #include <Orchestra/Legacy/Pfile.h>
 #include <Orchestra/Legacy/PfileReader.h>
@@ -41,6 +49,9 @@
 #include "num/fft.h"
 
 #include "BartIO.h"
+#include "CoilCompression.h"
+#include "NoiseWhitening.h"
+#include "FusedFFT.h"
 
 // project includes
 #include "CommandLine.h"
@@ -53,10 +64,71 @@ using namespace GERecon;
 using namespace MDArray;
 
 
+/**
+ * Write the weights of the selected channels, or of the virtual coils when compressing
+ */
+static void WriteChannelWeights(const std::string& name, const FloatVector& channelWeights, const BartIO::Selection& selection, const long numChannels, const boost::shared_ptr<const BartIO::CoilCompression>& coils)
+{
+	long cdims[DIMS];
+	md_singleton_dims(DIMS, cdims);
+	cdims[COIL_DIM] = coils ? coils->VirtualCount() : numChannels;
+
+	_Complex float* weights = (_Complex float*)create_cfl(name.c_str(), DIMS, cdims);
+
+	std::vector<_Complex float> cweights(numChannels);
+
+	for (int currentChannel = 0; currentChannel < numChannels; currentChannel++)
+		cweights[currentChannel] = channelWeights(selection.start[4] + currentChannel);
+
+	if (coils)
+		coils->Weights(weights, cweights.data());
+	else
+		std::copy(cweights.begin(), cweights.end(), weights);
+
+	unmap_cfl(DIMS, cdims, weights);
+}
+
+
+/**
+ * Write one block of follow mode to <output>_<block>. The block is written
+ * under a temporary name and renamed, header last, so that readers polling
+ * for the header only see complete blocks.
+ */
+static void WriteFollowBlock(const std::string& output, const long block, const long bdims[PFILE_DIMS], const long bstrs[PFILE_DIMS], const _Complex float* data,
+		const long fftmod_flags, const long ifft_flags, const long fft_flags)
+{
+	std::ostringstream strm;
+	strm << output << "_" << std::setw(4) << std::setfill('0') << block;
+
+	const std::string final = strm.str();
+	const std::string partial = final + ".part";
+
+	long odims[DIMS];
+	BartIO::FormatBartMRIDims(odims, bdims);
+
+	long ostrs[PFILE_DIMS];
+	BartIO::FormatBartMRIStrides(ostrs, odims);
+
+	_Complex float* ksp = (_Complex float*)create_cfl(partial.c_str(), DIMS, odims);
+
+	md_copy2(PFILE_DIMS, bdims, ostrs, ksp, bstrs, data, CFL_SIZE);
+
+	BartIO::FusedFFTApply(PFILE_DIMS, bdims, ostrs, ksp, fftmod_flags, ifft_flags, fft_flags);
+
+	unmap_cfl(DIMS, odims, ksp);
+
+	if ((0 != rename((partial + ".cfl").c_str(), (final + ".cfl").c_str()))
+	    || (0 != rename((partial + ".hdr").c_str(), (final + ".hdr").c_str())))
+		error("Could not write block %s!\n", final.c_str());
+
+	std::cout << "Wrote " << final << " (" << bdims[1] << " readouts)" << std::endl;
+}
+
+
 /**
  * Write Pfile data to BART-formatted file
  */
-void GERecon::BartWrite()
+void GERecon::ScanArchiveToBartTool::BartWrite()
 {
 	GERecon::Trace trace("ScanArchiveToBart");
 
@@ -64,11 +136,19 @@ void GERecon::BartWrite()
 	const long fft_flags = *CommandLine::FFT();
 	const long fftmod_flags = *CommandLine::FFTMod();
 	const unsigned int store_sequential = *CommandLine::SequentialStorage();
+	const int numVirtualCoils = *CommandLine::VirtualCoils();
+	const long followViews = *CommandLine::Follow();
 
 	// Read Pfile from command line
 	const boost::filesystem::path filePath = CommandLine::ScanArchivePath();
 	const ScanArchivePointer scanArchive = ScanArchive::Create(filePath, GESystem::Archive::LoadMode);
 
+	if (*CommandLine::BuildIndex()) {
+
+		BartIO::ScanArchiveBuildIndex(scanArchive);
+		return;
+	}
+
 	const Legacy::ConstLxDownloadDataPointer downloadData = boost::dynamic_pointer_cast<Legacy::LxDownloadData>(scanArchive->LoadDownloadData());
 	const boost::shared_ptr<Legacy::LxControlSource> controlSource = boost::make_shared<Legacy::LxControlSource>(downloadData);
 	const Control::ProcessingControlPointer processingControl = controlSource->CreateOrchestraProcessingControl();
@@ -96,92 +176,208 @@ void GERecon::BartWrite()
 	// Get weights output name
 	const boost::optional<std::string> ChannelWeightsString = CommandLine::ChannelWeights();
 
+	// only the selected frames and channels are copied
+	BartIO::Selection selection;
+
+	if (CommandLine::Slices())
+		selection.Select(2, *CommandLine::Slices());
+
+	if (CommandLine::Echoes())
+		selection.Select(3, *CommandLine::Echoes());
+
+	if (CommandLine::Channels())
+		selection.Select(4, *CommandLine::Channels());
+
+	// FIXME: differentiate between passes and phases
+	long scanDims[PFILE_DIMS];
+	md_singleton_dims(PFILE_DIMS, scanDims);
+	scanDims[0] = acqXRes;
+	scanDims[1] = acqYRes;
+	scanDims[2] = acqZRes;
+	scanDims[3] = numEchoes;
+	scanDims[4] = numChannels;
+	scanDims[5] = numPhases;
+
+	long selDims[PFILE_DIMS];
+	selection.Dims(selDims, scanDims);
+
+	// whitening of the selected channels, applied to each readout as it is placed
+	std::vector<_Complex float> whitening;
+
+	if (CommandLine::Noise()) {
+
+		std::cout << "bart whiten" << std::endl;
+		whitening = BartIO::LoadWhitening(*CommandLine::Noise(), numChannels, selection);
+	}
+
+	const _Complex float* whiten = whitening.empty() ? NULL : whitening.data();
+
+	// with coil compression, channels are read as acquired and the whitening
+	// is composed with the compression, as in PfileToBart
+	const _Complex float* readWhiten = (numVirtualCoils > 0) ? NULL : whiten;
+
+	// channel weights follow the whitened channels
+	boost::shared_ptr<const BartIO::CoilCompression> whitenedCoils;
+
+	if (NULL != whiten)
+		whitenedCoils = boost::make_shared<const BartIO::CoilCompression>(selDims[4], whiten);
+
+	if (followViews > 0) {
+
+		if (numVirtualCoils > 0)
+			error("Coil compression is not supported in follow mode!\n");
+
+		// blocks hold views in order of acquisition, not a phase encoding grid
+		if (0 != ((fftmod_flags | ifft_flags | fft_flags) & ~READ_FLAG))
+			error("Only READ (i)FFT flags are supported in follow mode!\n");
+
+		std::cout << "Follow mode. Writing blocks of " << followViews << " readouts" << std::endl;
+
+		if (ChannelWeightsString)
+			WriteChannelWeights(*ChannelWeightsString, channelWeights, selection, selDims[4], whitenedCoils);
+
+		BartIO::ScanArchiveFollow(scanDims, scanArchive, selection, followViews, *CommandLine::FollowTimeout(),
+			[&](long block, const long bdims[PFILE_DIMS], const long bstrs[PFILE_DIMS], const _Complex float* data) {
+
+				WriteFollowBlock(*OutString, block, bdims, bstrs, data, fftmod_flags, ifft_flags, fft_flags);
+			}, whiten);
+
+		return;
+	}
+
 	// load kspace data from Pfile
-	long dims[PFILE_DIMS];
-	md_singleton_dims(PFILE_DIMS, dims);
+	long fdims[PFILE_DIMS];
+	md_singleton_dims(PFILE_DIMS, fdims);
 
 	//bool store_sequential = true; // FIXME: test sequential writing
 
+	// frames of sequential mode, read in one pass when there is no index
+	BartIO::FrameChunks frames;
+	bool framesRead = false;
+
 	if (store_sequential) {
 
 		std::cout << "Sequential mode. Storing data sequentially in the output" << std::endl;
-		dims[0] = acqXRes;
-		dims[1] = acqYRes * acqZRes * numEchoes * numPhases;
-		dims[4] = numChannels;
+
+		// exact number of selected frames, from the packet index or by reading them
+		fdims[0] = acqXRes;
+		fdims[1] = BartIO::ScanArchiveFrameCount(scanArchive, selection);
+		fdims[4] = numChannels;
+
+		if (fdims[1] < 0) {
+
+			fdims[1] = BartIO::ScanArchiveReadFrames(frames, scanDims, scanArchive, selection, readWhiten);
+			framesRead = true;
+		}
+
+		if (0 == fdims[1])
+			error("No frames in the selection!\n");
 	}
 	else {
 
-		// FIXME: differentiate between passes and phases
-		dims[0] = acqXRes;
-		dims[1] = acqYRes;
-		dims[2] = acqZRes;
-		dims[3] = numEchoes;
-		dims[4] = numChannels;
-		dims[5] = numPhases;
+		md_copy_dims(PFILE_DIMS, fdims, scanDims);
 	}
 
+	// dims of the selection
+	long dims[PFILE_DIMS];
+	md_copy_dims(PFILE_DIMS, dims, fdims);
+
+	if (store_sequential)
+		dims[4] = selDims[4];
+	else
+		md_copy_dims(PFILE_DIMS, dims, selDims);
+
 	debug_print_dims(DP_INFO, PFILE_DIMS, dims);
 
-	// copy into bart-formatted ksp array
-	_Complex float* ksp2 = (_Complex float*)md_alloc(PFILE_DIMS, dims, CFL_SIZE);
-	_Complex float* ksp3 = NULL;
+	if (0 != fftmod_flags)
+		std::cout << "bart fftmod " << fftmod_flags << std::endl;
+
+	if (0 != ifft_flags)
+		std::cout << "bart fft -iu " << ifft_flags << std::endl;
 
-	long num_views = BartIO::ScanArchiveToBart(dims, ksp2, scanArchive, store_sequential);
+	if (0 != fft_flags)
+		std::cout << "bart fft -u " << fft_flags << std::endl;
 
-	if (store_sequential && num_views < dims[1]) {
+	long odims[DIMS];
+	BartIO::FormatBartMRIDims(odims, dims);
 
-		long dims1[PFILE_DIMS];
-		md_select_dims(PFILE_DIMS, ~MD_BIT(1), dims1, dims);
-		dims1[1] = num_views;
-		long pos[PFILE_DIMS];
-		md_set_dims(PFILE_DIMS, pos, 0);
-		ksp3 = (_Complex float*)md_alloc(PFILE_DIMS, dims, CFL_SIZE);
-		md_copy_block(PFILE_DIMS, pos, dims1, ksp3, dims, ksp2, CFL_SIZE);
-		md_free(ksp2);
-		ksp2 = ksp3;
-	}
+	if (numVirtualCoils > 0)
+		odims[COIL_DIM] = numVirtualCoils;
 
-	if (0 != fftmod_flags) {
+	boost::shared_ptr<const BartIO::CoilCompression> coils;
 
-		std::cout << "bart fftmod " << fftmod_flags << std::endl;
-		fftmod(PFILE_DIMS, dims, fftmod_flags, ksp2, ksp2);
-	}
+	_Complex float* ksp = NULL;
 
-	if (0 != ifft_flags) {
+	if (numVirtualCoils > 0) {
 
-		std::cout << "bart fft -iu " << ifft_flags << std::endl;
-		ifftuc(PFILE_DIMS, dims, ifft_flags, ksp2, ksp2);
-	}
+		// the compression is learned from the calibration region alone, so the
+		// channels are never held in full. It whitens the region before learning
+		const BartIO::CoilCompression::Type ccType = BartIO::CoilCompression::TypeFromString(*CommandLine::CoilCompressionType());
 
-	if (0 != fft_flags) {
-		
-		std::cout << "bart fft -u " << fft_flags << std::endl;
-		fftuc(PFILE_DIMS, dims, fft_flags, ksp2, ksp2);
-	}
+		long caldims[PFILE_DIMS];
+		BartIO::CoilCompression::CalibrationDims(caldims, dims, ccType, *CommandLine::CoilCompressionCalib());
 
+		_Complex float* cal = (_Complex float*)md_alloc(PFILE_DIMS, caldims, CFL_SIZE);
 
-	long odims[DIMS];
-	BartIO::FormatBartMRIDims(odims, dims);
+		if (framesRead)
+			BartIO::FramesCalibration(caldims, cal, dims, frames);
+		else
+			BartIO::ScanArchiveCalibration(caldims, cal, fdims, scanArchive, store_sequential, selection);
+
+		std::cout << "bart cc -p " << numVirtualCoils << " " << *CommandLine::CoilCompressionType() << std::endl;
+		coils = boost::make_shared<const BartIO::CoilCompression>(ccType, numVirtualCoils, caldims, cal, whiten);
+
+		md_free(cal);
+
+		// readouts are compressed straight into the bart-formatted output.
+		// Transforms run on the virtual coils
+		ksp = (_Complex float*)create_cfl(OutString->c_str(), DIMS, odims);
+
+		long ostrs[PFILE_DIMS];
+		BartIO::FormatBartMRIStrides(ostrs, odims);
 
-	_Complex float* ksp = (_Complex float*)create_cfl(OutString->c_str(), DIMS, odims);
+		long vdims[PFILE_DIMS];
+		md_copy_dims(PFILE_DIMS, vdims, dims);
+		vdims[4] = coils->VirtualCount();
 
-	BartIO::FormatBartMRI(odims, ksp, dims, ksp2);
+		if (framesRead) {
+
+			BartIO::CopyFrames(dims, ostrs, ksp, frames, coils.get());
+			frames.clear();
+		}
+		else
+			BartIO::ScanArchiveToBart2(fdims, ostrs, ksp, scanArchive, store_sequential, selection, NULL, coils.get());
+
+		if (coils->Hybrid())
+			BartIO::FusedFFTApply(PFILE_DIMS, vdims, ostrs, ksp, 0, 0, MD_BIT(0));
+
+		BartIO::FusedFFTApply(PFILE_DIMS, vdims, ostrs, ksp, fftmod_flags, ifft_flags, fft_flags);
+	}
+	else {
 
-	md_free(ksp2);
+		// frames are copied straight into the bart-formatted output,
+		// which is zero-filled when created
+		ksp = (_Complex float*)create_cfl(OutString->c_str(), DIMS, odims);
 
-	if (ChannelWeightsString) {
+		long ostrs[PFILE_DIMS];
+		BartIO::FormatBartMRIStrides(ostrs, odims);
 
-		long cdims[DIMS];
-		md_select_dims(DIMS, COIL_FLAG, cdims, odims);
+		if (framesRead) {
 
-		_Complex float* weights = (_Complex float*)create_cfl(ChannelWeightsString->c_str(), DIMS, cdims);
+			BartIO::CopyFrames(dims, ostrs, ksp, frames);
+			frames.clear();
+		}
+		else
+			BartIO::ScanArchiveToBart2(fdims, ostrs, ksp, scanArchive, store_sequential, selection, whiten);
 
-		for (int currentChannel = 0; currentChannel < numChannels; currentChannel++)
-			weights[currentChannel] = channelWeights(currentChannel);
+		coils = whitenedCoils;
 
-		unmap_cfl(DIMS, cdims, weights);
+		// fftmod, fft -iu and fft -u in one pass per block
+		BartIO::FusedFFTApply(PFILE_DIMS, dims, ostrs, ksp, fftmod_flags, ifft_flags, fft_flags);
 	}
 
+	if (ChannelWeightsString)
+		WriteChannelWeights(*ChannelWeightsString, channelWeights, selection, dims[4], coils);
 
 	unmap_cfl(DIMS, odims, ksp);
 }